@@ -10,6 +10,13 @@ static const int systraypinningfailfirst = 1; /* 1: if pinning fails, display sy
 static const int showsystray = 1;			  /* 0 means no systray */
 static const int showbar = 1;				  /* 0 means no bar */
 static const int topbar = 1;				  /* 0 means bottom bar */
+static const int schedfocus = 0;			  /* 1 means adjust the nice level of client processes by focus */
+static const int nicefocused = -5;			  /* focused client, limited by RLIMIT_NICE */
+static const int nicebackground = 10;		  /* clients that are all on hidden tags or iconified */
+static const int freezedelay = 30;			  /* seconds before a hidden client with the freeze rule is stopped */
+static const unsigned int iconcachesize = 32;  /* window icons kept scaled for the bar, least recently drawn are dropped */
+static const double idleslice = 2;			  /* ms of cache warming at a time while no input is pending */
+static const char shotdir[] = "Pictures";	  /* screenshots go here, relative to $HOME unless absolute */
 static const char *fonts[] = {"Cantarell-Regular:size=12", "Fira Code Nerd Font:size=12"};
 
 static const char col_background[] = "#292f3a"; /* top bar dark background*/
@@ -68,11 +75,12 @@ static const Rule rules[] = {
 	 *	WM_CLASS(STRING) = instance, class
 	 *	WM_NAME(STRING) = title
 	 */
-	/* class      instance    title       tags mask     isfloating   monitor */
-	{"Pavucontrol", NULL,     NULL,       0,            1,           -1},
-	{"Onboard", NULL,     NULL,       0,                1,           -1},
-	{"Welcome.py", NULL,     NULL,        0,            1,           -1},
-	{"ROX-Filer", NULL,     NULL,        0,            0,           -1},
+	/* tags is a Tagset, e.g. TAGBIT(8) for the ninth tag or {{0}} for the current one */
+	/* class      instance    title       tags          isfloating   freeze   monitor */
+	{"Pavucontrol", NULL,     NULL,       {{0}},        1,           0,       -1},
+	{"Onboard", NULL,     NULL,       {{0}},            1,           0,       -1},
+	{"Welcome.py", NULL,     NULL,        {{0}},        1,           0,       -1},
+	{"ROX-Filer", NULL,     NULL,        {{0}},        0,           0,       -1},
 };
 
 /* layout(s) */
@@ -104,11 +112,11 @@ static const Layout layouts[] = {
 /* key definitions */
 #define MODKEY Mod4Mask
 #define TAGKEYS(KEY, TAG)                                          \
-		{MODKEY, KEY, view, {.ui = 1 << TAG}},                     \
-		{MODKEY | ControlMask, KEY, toggleview, {.ui = 1 << TAG}}, \
-		{MODKEY | ShiftMask, KEY, tag, {.ui = 1 << TAG}},          \
-		{MODKEY | Mod1Mask, KEY, followtag, {.ui = 1 << TAG}},          \
-		{MODKEY | ControlMask | ShiftMask, KEY, toggletag, {.ui = 1 << TAG}},
+		{MODKEY, KEY, view, {.t = TAGBIT(TAG)}},                     \
+		{MODKEY | ControlMask, KEY, toggleview, {.t = TAGBIT(TAG)}}, \
+		{MODKEY | ShiftMask, KEY, tag, {.t = TAGBIT(TAG)}},          \
+		{MODKEY | Mod1Mask, KEY, followtag, {.t = TAGBIT(TAG)}},          \
+		{MODKEY | ControlMask | ShiftMask, KEY, toggletag, {.t = TAGBIT(TAG)}},
 
 
 #define SHCMD(cmd)                                           \
@@ -129,8 +137,6 @@ static const char *slockcmd[] = {"ilock", NULL};
 static const char *oslockcmd[] = {"instantlock", "-o", NULL};
 static const char *slockmcmd[] = {"ilock", "message", NULL};
 static const char *helpcmd[] = {"st", "-e", "instanthotkeys", NULL};
-static const char *instantswitchcmd[] = {"rofi", "-show", "window", "-kb-row-down", "Alt+Tab,Down", "-kb-row-up", "Alt+Ctrl+Tab,Up", "-kb-accept-entry", "!Alt_L,!Alt+Tab,Return", "-me-select-entry", "", "-me-accept-entry", "MousePrimary", NULL};
-static const char *caretinstantswitchcmd[] = {"rofi", "-show", "window", "-kb-row-down", "Alt+Tab,Down", "-kb-row-up", "Alt+Ctrl+Tab,Up", "-kb-accept-entry", "!Alt_L,!Alt+Tab,Return", "-me-select-entry", "", "-me-accept-entry", "MousePrimary", "-theme", "/usr/share/instantdotfiles/rofi/appmenu.rasi", NULL};
 static const char *onboardcmd[] = {"onboard", NULL};
 static const char *instantshutdowncmd[] = {"instantshutdown", NULL};
 static const char *notifycmd[] = {"instantnotify", NULL};
@@ -146,6 +152,7 @@ static const char  *scrotcmd[] = { "/opt/instantos/menus/dm/ss.sh", NULL };
 static const char  *fscrotcmd[] = { "/opt/instantos/menus/dm/sm.sh", NULL };
 static const char  *clipscrotcmd[] = { "/opt/instantos/menus/dm/sc.sh", NULL };
 static const char  *fclipscrotcmd[] = { "/opt/instantos/menus/dm/sf.sh", NULL };
+static const char  *wscrotcmd[] = { "scrot", "-u", NULL }; /* focused window */
 
 static const char  *firefoxcmd[] = { "firefox", NULL };
 
@@ -164,9 +171,9 @@ static Key dkeys[] = {
 	{0, XK_F1, spawn, {.v = helpcmd} },
 	{0, XK_m, spawn, {.v = spoticli} },
 	{0, XK_Return, spawn, {.v = termcmd} },
-	{0, XK_plus, spawn, {.v = upvol} },
-	{0, XK_minus, spawn, {.v = downvol} },
-	{0, XK_Tab, spawn, {.v = caretinstantswitchcmd} },
+	{0, XK_plus, queuecmd, {.v = upvol} },
+	{0, XK_minus, queuecmd, {.v = downvol} },
+	{0, XK_Tab, switcher, {0} },
 	{0, XK_c, spawn, {.v = codecmd} },
 	{0, XK_y, spawn, {.v = roficmd} },
 	
@@ -180,15 +187,15 @@ static Key dkeys[] = {
 	{0, XK_Up,      shiftview,      {.i = +1 } },
 	{0, XK_Down,      shiftview,      {.i = -1 } },
 	
-	{0, XK_1, view, {.ui = 1 << 0}},
-	{0, XK_2, view, {.ui = 1 << 1}},
-	{0, XK_3, view, {.ui = 1 << 2}},
-	{0, XK_4, view, {.ui = 1 << 3}},
-	{0, XK_5, view, {.ui = 1 << 4}},
-	{0, XK_6, view, {.ui = 1 << 5}},
-	{0, XK_7, view, {.ui = 1 << 6}},
-	{0, XK_8, view, {.ui = 1 << 7}},
-	{0, XK_9, view, {.ui = 1 << 8}},
+	{0, XK_1, view, {.t = TAGBIT(0)}},
+	{0, XK_2, view, {.t = TAGBIT(1)}},
+	{0, XK_3, view, {.t = TAGBIT(2)}},
+	{0, XK_4, view, {.t = TAGBIT(3)}},
+	{0, XK_5, view, {.t = TAGBIT(4)}},
+	{0, XK_6, view, {.t = TAGBIT(5)}},
+	{0, XK_7, view, {.t = TAGBIT(6)}},
+	{0, XK_8, view, {.t = TAGBIT(7)}},
+	{0, XK_9, view, {.t = TAGBIT(8)}},
 
 };
 
@@ -213,9 +220,9 @@ static Key keys[] = {
 	{MODKEY | ControlMask, XK_space, spawn, {.v = instantmenucmd}},
 	{MODKEY, XK_space, spawn, {.v = roficmd}},
 	{MODKEY, XK_minus, spawn, {.v = instantmenustcmd}},
-	{MODKEY, XK_x, spawn, {.v = instantswitchcmd}},
-	{Mod1Mask, XK_Tab, spawn, {.v = instantswitchcmd}},
-	{MODKEY, XK_dead_circumflex, spawn, {.v = caretinstantswitchcmd}},
+	{MODKEY, XK_x, switcher, {0}},
+	{Mod1Mask, XK_Tab, switcher, {0}},
+	{MODKEY, XK_dead_circumflex, switcher, {0}},
 	{MODKEY | ControlMask, XK_l, spawn, {.v = slockcmd}},
 	{MODKEY | ControlMask, XK_h, hidewin, {0}},
 	{MODKEY | Mod1Mask | ControlMask, XK_h, unhideall, {0}},
@@ -258,8 +265,8 @@ static Key keys[] = {
 	{MODKEY,                       XK_Left,   animleft,     {0}},
 	{MODKEY,                       XK_Right,  animright,    {0}},
 	
-	{MODKEY,                       XK_e,  overtoggle,    {.ui = ~0}},
-	{MODKEY|ShiftMask,             XK_e,  fullovertoggle,    {.ui = ~0}},
+	{MODKEY,                       XK_e,  overtoggle,    {.t = ALLTAGS}},
+	{MODKEY|ShiftMask,             XK_e,  fullovertoggle,    {.t = ALLTAGS}},
 
 	{MODKEY|ControlMask,           XK_Left,   shiftview,      {.i = -1 }},
 	{MODKEY|Mod1Mask,              XK_Left,   moveleft,     {0}},
@@ -280,8 +287,8 @@ static Key keys[] = {
 	{MODKEY|ControlMask,           XK_period, cyclelayout,    {.i = +1 } },
 	{MODKEY, XK_p, setlayout, {0}},
 	{MODKEY | ShiftMask, XK_space, togglefloating, {0}},
-	{MODKEY, XK_0, view, {.ui = ~0}},
-	{MODKEY | ShiftMask, XK_0, tag, {.ui = ~0}},
+	{MODKEY, XK_0, view, {.t = ALLTAGS}},
+	{MODKEY | ShiftMask, XK_0, tag, {.t = ALLTAGS}},
 	{MODKEY, XK_comma, focusmon, {.i = -1}},
 	{MODKEY, XK_period, focusmon, {.i = +1}},
 	{MODKEY | ShiftMask, XK_comma, tagmon, {.i = -1}},
@@ -296,15 +303,17 @@ static Key keys[] = {
 	TAGKEYS(XK_7, 6)
 	TAGKEYS(XK_8, 7)
 	TAGKEYS(XK_9, 8){MODKEY | ShiftMask, XK_q, quit, {0}},
-	{0, XF86XK_AudioLowerVolume, spawn, {.v = downvol}},
+	{MODKEY | ControlMask | ShiftMask, XK_q, restart, {0}},
+	{0, XF86XK_AudioLowerVolume, queuecmd, {.v = downvol}},
 	{0, XF86XK_AudioMute, spawn, {.v = mutevol}},
-	{0, XF86XK_AudioRaiseVolume, spawn, {.v = upvol}},
+	{0, XF86XK_AudioRaiseVolume, queuecmd, {.v = upvol}},
 	{0, XF86XK_AudioPlay, spawn, {.v = spoticli}},
 	{0, XF86XK_AudioNext, spawn, {.v = spotinext}},
 	{0, XF86XK_AudioPrev, spawn, {.v = spotiprev}},
 	
-	{0, XK_Print, spawn, {.v = fscrotcmd}},
-	{MODKEY, XK_Print, spawn, {.v = scrotcmd}},
+	{0, XK_Print, screenshot, {.i = ShotMonitor}},
+	{MODKEY, XK_Print, screenshot, {.i = ShotRegion}},
+	{ShiftMask, XK_Print, screenshot, {.i = ShotClient}},
 	{MODKEY|ControlMask, XK_Print, spawn, {.v = clipscrotcmd}},
 	{MODKEY|Mod1Mask, XK_Print, spawn, {.v = fclipscrotcmd}},
 
@@ -323,7 +332,7 @@ static Button buttons[] = {
 	{ ClkWinTitle,          0,              Button1,        dragmouse,      {0} },
 	{ ClkWinTitle,          MODKEY,         Button1,        setoverlay,     {0} },
 	{ ClkWinTitle,          MODKEY,         Button3,        spawn,          {.v = notifycmd } },
-	{ ClkStatusText,        0,              Button3,        spawn,          {.v = caretinstantswitchcmd } },
+	{ ClkStatusText,        0,              Button3,        switcher,       {0} },
 	{ ClkWinTitle,          0,              Button2,        killclient,       {0} },
 	{ ClkCloseButton,       0,              Button1,        killclient,       {0} },
 	{ ClkCloseButton,       0,              Button3,        togglelocked,       {0} },
@@ -333,15 +342,15 @@ static Button buttons[] = {
 	{ ClkWinTitle,          ShiftMask,      Button5,        pushdown,       {0} },
 	{ ClkWinTitle,          ShiftMask,      Button4,        pushup,         {0} },
 	{ ClkStatusText,        0,              Button2,        spawn,          {.v = termcmd } },
-	{ ClkStatusText,        0,              Button4,        spawn,          {.v = upvol } },
-	{ ClkStatusText,        0,              Button5,        spawn,          {.v = downvol } },
+	{ ClkStatusText,        0,              Button4,        queuecmd,       {.v = upvol } },
+	{ ClkStatusText,        0,              Button5,        queuecmd,       {.v = downvol } },
 	{ ClkStatusText,        MODKEY,         Button2,        spawn,          {.v = mutevol } },
 	{ ClkStatusText,        0,              Button1,        spawn,          {.v = panther } },
 	{ ClkStatusText,        MODKEY|ShiftMask,Button1,       spawn,          {.v = pavucontrol } },
 	{ ClkStatusText,        MODKEY,         Button1,       spawn,          {.v = instantsettings } },
 	{ ClkStatusText,        MODKEY,         Button3,        spawn,          {.v = spoticli } },
-	{ ClkStatusText,        MODKEY,         Button4,        spawn,          {.v = upbright } },
-	{ ClkStatusText,        MODKEY,         Button5,        spawn,          {.v = downbright } },
+	{ ClkStatusText,        MODKEY,         Button4,        queuecmd,       {.v = upbright } },
+	{ ClkStatusText,        MODKEY,         Button5,        queuecmd,       {.v = downbright } },
 	{ ClkRootWin,           MODKEY,         Button3,        spawn,          {.v = notifycmd } },
 	{ ClkRootWin,           0,              Button1,        spawn,          {.v = panther } },
 	{ ClkRootWin,           MODKEY,         Button1,        setoverlay,     {0} },
@@ -14,18 +14,45 @@ X11LIB = /usr/X11R6/lib
 XINERAMALIBS  = -lXinerama
 XINERAMAFLAGS = -DXINERAMA
 
+# XRandR monitor hotplug, comment if you don't want it
+RANDRLIBS  = -lXrandr
+RANDRFLAGS = -DRANDR
+
+# Composite/Damage/Render overview thumbnails, comment if you don't want it
+COMPOSITELIBS  = -lXcomposite -lXdamage -lXfixes -lXrender
+COMPOSITEFLAGS = -DCOMPOSITE
+
+# Present vblank frame clock, comment if you don't want it
+PRESENTLIBS  = -lXpresent
+PRESENTFLAGS = -DPRESENT
+
+# MIT-SHM software bar renderer, comment if you don't want it
+SHMLIBS  = -lXext -lfreetype
+SHMFLAGS = -DXSHM
+
+# draw bars on a thread of their own, comment if you don't want it
+BARTHREADLIBS  = -lpthread
+BARTHREADFLAGS = -DBARTHREAD
+
+# native png screenshots, comment if you don't want it
+SCREENSHOTLIBS  = -lz -lpthread
+SCREENSHOTFLAGS = -DSCREENSHOT
+
+# highest number of tags config.h may define, at most 256
+MAXTAGS = 64
+
 # freetype
-FREETYPELIBS = -lfontconfig -lXft
+FREETYPELIBS = -lfontconfig -lXft -lXrender
 FREETYPEINC = /usr/include/freetype2
 # OpenBSD (uncomment)
 #FREETYPEINC = ${X11INC}/freetype2
 
 # includes and libs
 INCS = -I${X11INC} -I${FREETYPEINC}
-LIBS = -L${X11LIB} -lX11 ${XINERAMALIBS} ${FREETYPELIBS}
+LIBS = -L${X11LIB} -lX11 ${XINERAMALIBS} ${RANDRLIBS} ${COMPOSITELIBS} ${PRESENTLIBS} ${SHMLIBS} ${BARTHREADLIBS} ${SCREENSHOTLIBS} ${FREETYPELIBS}
 
 # flags
-CPPFLAGS = -D_DEFAULT_SOURCE -D_BSD_SOURCE -D_POSIX_C_SOURCE=200809L -DVERSION=\"${VERSION}\" ${XINERAMAFLAGS}
+CPPFLAGS = -D_DEFAULT_SOURCE -D_BSD_SOURCE -D_POSIX_C_SOURCE=200809L -DVERSION=\"${VERSION}\" -DMAXTAGS=${MAXTAGS} ${XINERAMAFLAGS} ${RANDRFLAGS} ${COMPOSITEFLAGS} ${PRESENTFLAGS} ${SHMFLAGS} ${BARTHREADFLAGS} ${SCREENSHOTFLAGS}
 #CFLAGS   = -g -std=c99 -pedantic -Wall -O0 ${INCS} ${CPPFLAGS}
 CFLAGS   = -std=c99 -pedantic -Wall -Wno-deprecated-declarations -Os ${INCS} ${CPPFLAGS}
 LDFLAGS  = ${LIBS}
@@ -4,7 +4,18 @@
 #include <string.h>
 #include <X11/Xlib.h>
 
+#include <stdint.h>
 #include <X11/Xft/Xft.h>
+#ifdef XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#include <X11/extensions/XShm.h>
+#include <ft2build.h>
+#include FT_FREETYPE_H
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+#endif /* XSHM */
 
 #include "drw.h"
 #include "util.h"
@@ -12,6 +23,50 @@
 #define UTF_INVALID 0xFFFD
 #define UTF_SIZ     4
 
+#define SPRITES     128
+#define SPRITEW     1024
+#define SPRITEH     256
+
+/* regions rendered once and blitted from an atlas afterwards */
+struct SpriteCache {
+	struct {
+		unsigned long key;
+		short x, y, w, h; /* in the atlas */
+	} sprite[SPRITES];
+	int n;
+	int penx, peny, rowh;
+	Pixmap pix;   /* atlas when drawing through Xlib */
+	char *buf;    /* atlas when drawing into the shm buffer */
+};
+
+#ifdef XSHM
+#define ATLASW      512
+#define ATLASH      256
+#define GLYPHSLOTS  512 /* power of two, kept at most half full */
+
+typedef struct {
+	long cp; /* -1 marks a free slot */
+	short x, y, w, h; /* coverage in the atlas */
+	short left, top, adv;
+} CachedGlyph;
+
+/* rasterized glyphs of one font, shelf packed into an alpha atlas */
+struct GlyphCache {
+	CachedGlyph slot[GLYPHSLOTS];
+	int count;
+	int penx, peny, rowh;
+	unsigned char atlas[ATLASW * ATLASH];
+};
+
+/* client-side ARGB copy of the drawable, uploaded with XShmPutImage */
+struct Shm {
+	XImage *img;
+	XShmSegmentInfo info;
+};
+
+static int shmfailed;
+#endif /* XSHM */
+
 static const unsigned char utfbyte[UTF_SIZ + 1] = {0x80,    0, 0xC0, 0xE0, 0xF0};
 static const unsigned char utfmask[UTF_SIZ + 1] = {0xC0, 0x80, 0xE0, 0xF0, 0xF8};
 static const long utfmin[UTF_SIZ + 1] = {       0,    0,  0x80,  0x800,  0x10000};
@@ -61,6 +116,294 @@ utf8decode(const char *c, long *u, size_t clen)
 	return len;
 }
 
+#ifdef XSHM
+static int
+shmerror(Display *dpy, XErrorEvent *ee)
+{
+	shmfailed = 1;
+	return 0;
+}
+
+/* The software renderer only handles the common 32bpp xRGB layout. The
+ * attach is only probed when the drw is created: the error handler is
+ * process wide and drw_resize() may run on another thread */
+static struct Shm *
+shm_create(Drw *drw, unsigned int w, unsigned int h, int probe)
+{
+	Visual *visual = DefaultVisual(drw->dpy, drw->screen);
+	XErrorHandler xerror;
+	struct Shm *s;
+
+	if (visual->class != TrueColor || visual->red_mask != 0xff0000
+	|| visual->green_mask != 0xff00 || visual->blue_mask != 0xff
+	|| !XShmQueryExtension(drw->dpy))
+		return NULL;
+	s = ecalloc(1, sizeof(struct Shm));
+	s->info.shmid = -1;
+	s->info.shmaddr = (char *)-1;
+	s->img = XShmCreateImage(drw->dpy, visual, DefaultDepth(drw->dpy, drw->screen),
+	                         ZPixmap, NULL, &s->info, w, h);
+	if (!s->img || s->img->bits_per_pixel != 32
+	|| (s->info.shmid = shmget(IPC_PRIVATE, s->img->bytes_per_line * h, IPC_CREAT | 0600)) < 0
+	|| (s->info.shmaddr = shmat(s->info.shmid, NULL, 0)) == (char *)-1)
+		goto fail;
+	s->img->data = s->info.shmaddr;
+	s->info.readOnly = True;
+	/* attaching fails on remote displays, which only shows up as an error */
+	if (probe) {
+		XSync(drw->dpy, False);
+		shmfailed = 0;
+		xerror = XSetErrorHandler(shmerror);
+	}
+	XShmAttach(drw->dpy, &s->info);
+	XSync(drw->dpy, False);
+	if (probe) {
+		XSetErrorHandler(xerror);
+		if (shmfailed)
+			goto fail;
+	}
+	shmctl(s->info.shmid, IPC_RMID, NULL);
+	return s;
+
+fail:
+	if (s->info.shmaddr != (char *)-1)
+		shmdt(s->info.shmaddr);
+	if (s->info.shmid >= 0)
+		shmctl(s->info.shmid, IPC_RMID, NULL);
+	if (s->img)
+		XDestroyImage(s->img);
+	free(s);
+	return NULL;
+}
+
+static void
+shm_free(Drw *drw)
+{
+	struct Shm *s = drw->shm;
+
+	if (!s)
+		return;
+	XShmDetach(drw->dpy, &s->info);
+	XSync(drw->dpy, False);
+	XDestroyImage(s->img); /* leaves the segment alone */
+	shmdt(s->info.shmaddr);
+	free(s);
+	drw->shm = NULL;
+}
+
+/* fill n pixels, 16 bytes at a time where possible */
+static void
+span(uint32_t *p, uint32_t pixel, int n)
+{
+#ifdef __SSE2__
+	__m128i v = _mm_set1_epi32(pixel);
+
+	for (; n > 0 && ((uintptr_t)p & 15); n--)
+		*p++ = pixel;
+	for (; n >= 16; n -= 16, p += 16) {
+		_mm_store_si128((__m128i *)p, v);
+		_mm_store_si128((__m128i *)p + 1, v);
+		_mm_store_si128((__m128i *)p + 2, v);
+		_mm_store_si128((__m128i *)p + 3, v);
+	}
+	for (; n >= 4; n -= 4, p += 4)
+		_mm_store_si128((__m128i *)p, v);
+#endif /* __SSE2__ */
+	while (n-- > 0)
+		*p++ = pixel;
+}
+
+static void
+shm_fill(struct Shm *s, int x, int y, int w, int h, unsigned long pixel)
+{
+	int stride = s->img->bytes_per_line / 4;
+	uint32_t *row;
+
+	if (x < 0) {
+		w += x;
+		x = 0;
+	}
+	if (y < 0) {
+		h += y;
+		y = 0;
+	}
+	w = MIN(w, s->img->width - x);
+	h = MIN(h, s->img->height - y);
+	if (w <= 0 || h <= 0)
+		return;
+	for (row = (uint32_t *)s->img->data + y * stride + x; h--; row += stride)
+		span(row, pixel, w);
+}
+
+/* fill from x0 to x1 on row y, in either order */
+static void
+shm_hline(struct Shm *s, int x0, int x1, int y, unsigned long pixel)
+{
+	if (x0 > x1)
+		shm_fill(s, x1, y, x0 - x1 + 1, 1, pixel);
+	else
+		shm_fill(s, x0, y, x1 - x0 + 1, 1, pixel);
+}
+
+static CachedGlyph *
+glyph_get(Fnt *font, long cp)
+{
+	struct GlyphCache *gc;
+	CachedGlyph *g;
+	FT_Face face;
+	FT_Bitmap *bm;
+	unsigned int i, h, r, c;
+
+	if (!font->glyphs) {
+		font->glyphs = ecalloc(1, sizeof(struct GlyphCache));
+		for (i = 0; i < GLYPHSLOTS; i++)
+			font->glyphs->slot[i].cp = -1;
+	}
+	gc = font->glyphs;
+	h = (unsigned long)cp * 2654435761u;
+	for (i = 0; i < GLYPHSLOTS; i++) {
+		g = &gc->slot[(h + i) & (GLYPHSLOTS - 1)];
+		if (g->cp == cp)
+			return g;
+		if (g->cp < 0)
+			break;
+	}
+
+	if (!(face = XftLockFace(font->xfont)))
+		return NULL;
+	if (FT_Load_Char(face, cp, FT_LOAD_RENDER)
+	|| (face->glyph->bitmap.pixel_mode != FT_PIXEL_MODE_GRAY
+	&& face->glyph->bitmap.pixel_mode != FT_PIXEL_MODE_MONO)
+	|| face->glyph->bitmap.width > ATLASW || face->glyph->bitmap.rows > ATLASH) {
+		XftUnlockFace(font->xfont);
+		return NULL;
+	}
+	bm = &face->glyph->bitmap;
+	if (gc->penx + bm->width > ATLASW) {
+		gc->penx = 0;
+		gc->peny += gc->rowh;
+		gc->rowh = 0;
+	}
+	/* start over once the atlas or the table fills up */
+	if (gc->peny + bm->rows > ATLASH || gc->count >= GLYPHSLOTS / 2) {
+		for (i = 0; i < GLYPHSLOTS; i++)
+			gc->slot[i].cp = -1;
+		gc->count = gc->penx = gc->peny = gc->rowh = 0;
+	}
+	for (i = 0; gc->slot[(h + i) & (GLYPHSLOTS - 1)].cp >= 0; i++);
+	g = &gc->slot[(h + i) & (GLYPHSLOTS - 1)];
+
+	for (r = 0; r < bm->rows; r++) {
+		unsigned char *src = bm->buffer + r * bm->pitch;
+		unsigned char *dst = gc->atlas + (gc->peny + r) * ATLASW + gc->penx;
+
+		if (bm->pixel_mode == FT_PIXEL_MODE_GRAY)
+			memcpy(dst, src, bm->width);
+		else
+			for (c = 0; c < bm->width; c++)
+				dst[c] = src[c / 8] & (0x80 >> (c % 8)) ? 255 : 0;
+	}
+	g->cp = cp;
+	g->x = gc->penx;
+	g->y = gc->peny;
+	g->w = bm->width;
+	g->h = bm->rows;
+	g->left = face->glyph->bitmap_left;
+	g->top = face->glyph->bitmap_top;
+	g->adv = (face->glyph->advance.x + 32) >> 6;
+	gc->penx += bm->width;
+	gc->rowh = MAX(gc->rowh, (int)bm->rows);
+	gc->count++;
+	XftUnlockFace(font->xfont);
+	return g;
+}
+
+/* draw a glyph the atlas cannot hold (colour bitmaps and the like) with
+ * Xft: push the covered part of the buffer to the pixmap, draw there and
+ * read the result back. Slow, but only taken for rare glyphs */
+static int
+shm_xft(Drw *drw, Fnt *font, int x, int y, const char *text, size_t len, const Clr *col)
+{
+	struct Shm *s = drw->shm;
+	XGlyphInfo ext;
+	XftDraw *d;
+	int bx, by, bw, bh;
+
+	XftTextExtentsUtf8(drw->dpy, font->xfont, (XftChar8 *)text, len, &ext);
+	bx = MAX(x - ext.x, 0);
+	by = MAX(y - ext.y, 0);
+	bw = MIN(x - ext.x + ext.width, s->img->width) - bx;
+	bh = MIN(y - ext.y + ext.height, s->img->height) - by;
+	if (bw <= 0 || bh <= 0)
+		return ext.xOff;
+	XShmPutImage(drw->dpy, drw->drawable, drw->gc, s->img, bx, by, bx, by, bw, bh, False);
+	d = XftDrawCreate(drw->dpy, drw->drawable, DefaultVisual(drw->dpy, drw->screen),
+	                  DefaultColormap(drw->dpy, drw->screen));
+	XftDrawStringUtf8(d, col, font->xfont, x, y, (XftChar8 *)text, len);
+	XftDrawDestroy(d);
+	XGetSubImage(drw->dpy, drw->drawable, bx, by, bw, bh, AllPlanes, ZPixmap, s->img, bx, by);
+	return ext.xOff;
+}
+
+/* blend text in col onto the buffer, y is the baseline */
+static void
+shm_string(Drw *drw, Fnt *font, int x, int y, const char *text, size_t len, const Clr *col)
+{
+	struct Shm *s = drw->shm;
+	int stride = s->img->bytes_per_line / 4;
+	unsigned int fr = col->color.red >> 8, fg = col->color.green >> 8, fb = col->color.blue >> 8;
+	unsigned int a, p, dr, dg, db;
+	uint32_t *row;
+	unsigned char *cov;
+	size_t n;
+	long cp;
+	CachedGlyph *g;
+	int gx, gy, r, c;
+
+	while (len && (n = utf8decode(text, &cp, MIN(len, UTF_SIZ)))) {
+		text += n;
+		len -= n;
+		if (!(g = glyph_get(font, cp))) {
+			x += shm_xft(drw, font, x, y, text - n, n, col);
+			continue;
+		}
+		gx = x + g->left;
+		gy = y - g->top;
+		for (r = MAX(0, -gy); r < g->h && gy + r < s->img->height; r++) {
+			row = (uint32_t *)s->img->data + (gy + r) * stride;
+			cov = font->glyphs->atlas + (g->y + r) * ATLASW + g->x;
+			for (c = MAX(0, -gx); c < g->w && gx + c < s->img->width; c++) {
+				if (!(a = cov[c]))
+					continue;
+				p = row[gx + c];
+				dr = p >> 16 & 0xff;
+				dg = p >> 8 & 0xff;
+				db = p & 0xff;
+				dr += ((int)(fr - dr) * (int)a + 127) / 255;
+				dg += ((int)(fg - dg) * (int)a + 127) / 255;
+				db += ((int)(fb - db) * (int)a + 127) / 255;
+				row[gx + c] = dr << 16 | dg << 8 | db;
+			}
+		}
+		x += g->adv;
+	}
+}
+#endif /* XSHM */
+
+/* fill a rectangle in the buffer or on the server, whichever we draw to */
+static void
+fill(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned long pixel)
+{
+#ifdef XSHM
+	if (drw->shm) {
+		shm_fill(drw->shm, x, y, w, h, pixel);
+		return;
+	}
+#endif /* XSHM */
+	XSetForeground(drw->dpy, drw->gc, pixel);
+	XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
+}
+
 Drw *
 drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h)
 {
@@ -74,6 +417,9 @@ drw_create(Display *dpy, int screen, Window root, unsigned int w, unsigned int h
 	drw->drawable = XCreatePixmap(dpy, root, w, h, DefaultDepth(dpy, screen));
 	drw->gc = XCreateGC(dpy, root, 0, NULL);
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter);
+#ifdef XSHM
+	drw->shm = shm_create(drw, w, h, 1);
+#endif /* XSHM */
 
 	return drw;
 }
@@ -88,12 +434,30 @@ drw_resize(Drw *drw, unsigned int w, unsigned int h)
 	drw->h = h;
 	if (drw->drawable)
 		XFreePixmap(drw->dpy, drw->drawable);
+	if (drw->picture) {
+		XRenderFreePicture(drw->dpy, drw->picture);
+		drw->picture = None;
+	}
 	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, DefaultDepth(drw->dpy, drw->screen));
+	/* sprites are bar high and keep their backend, start over */
+	drw_sprite_flush(drw);
+#ifdef XSHM
+	if (drw->shm) {
+		shm_free(drw);
+		drw->shm = shm_create(drw, w, h, 0);
+	}
+#endif /* XSHM */
 }
 
 void
 drw_free(Drw *drw)
 {
+	drw_sprite_flush(drw);
+#ifdef XSHM
+	shm_free(drw);
+#endif /* XSHM */
+	if (drw->picture)
+		XRenderFreePicture(drw->dpy, drw->picture);
 	XFreePixmap(drw->dpy, drw->drawable);
 	XFreeGC(drw->dpy, drw->gc);
 	free(drw);
@@ -163,6 +527,7 @@ xfont_free(Fnt *font)
 	if (font->pattern)
 		FcPatternDestroy(font->pattern);
 	XftFontClose(font->dpy, font->xfont);
+	free(font->glyphs);
 	free(font);
 }
 
@@ -181,6 +546,7 @@ drw_fontset_create(Drw* drw, const char *fonts[], size_t fontcount)
 			ret = cur;
 		}
 	}
+	drw_sprite_flush(drw);
 	return (drw->fonts = ret);
 }
 
@@ -219,14 +585,17 @@ drw_scm_create(Drw *drw, const char *clrnames[], size_t clrcount)
 
 	for (i = 0; i < clrcount; i++)
 		drw_clr_create(drw, &ret[i], clrnames[i]);
+	drw_sprite_flush(drw); /* a new theme */
 	return ret;
 }
 
 void
 drw_setfontset(Drw *drw, Fnt *set)
 {
-	if (drw)
+	if (drw && drw->fonts != set) {
 		drw->fonts = set;
+		drw_sprite_flush(drw);
+	}
 }
 
 void
@@ -239,13 +608,35 @@ drw_setscheme(Drw *drw, Clr *scm)
 void
 drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int invert)
 {
+	unsigned long pixel;
+
 	if (!drw || !drw->scheme)
 		return;
-	XSetForeground(drw->dpy, drw->gc, invert ? drw->scheme[ColBg].pixel : drw->scheme[ColFg].pixel);
-	if (filled)
-		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-	else
-		XDrawRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w - 1, h - 1);
+	pixel = invert ? drw->scheme[ColBg].pixel : drw->scheme[ColFg].pixel;
+	if (filled) {
+		fill(drw, x, y, w, h, pixel);
+		return;
+	}
+#ifdef XSHM
+	if (drw->shm) {
+		fill(drw, x, y, w, 1, pixel);
+		fill(drw, x, y + h - 1, w, 1, pixel);
+		fill(drw, x, y, 1, h, pixel);
+		fill(drw, x + w - 1, y, 1, h, pixel);
+		return;
+	}
+#endif /* XSHM */
+	XSetForeground(drw->dpy, drw->gc, pixel);
+	XDrawRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w - 1, h - 1);
+}
+
+/* fill with color col of the current scheme */
+void
+drw_fill(Drw *drw, int x, int y, unsigned int w, unsigned int h, int col)
+{
+	if (!drw || !drw->scheme)
+		return;
+	fill(drw, x, y, w, h, drw->scheme[col].pixel);
 }
 
 void
@@ -253,6 +644,30 @@ drw_circ(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int
 {
 	if (!drw || !drw->scheme)
 		return;
+#ifdef XSHM
+	if (drw->shm) {
+		unsigned long pixel = invert ? drw->scheme[ColBg].pixel : drw->scheme[ColFg].pixel;
+		long long ww = (long long)w * w, hh = (long long)h * h, dy;
+		int r, c;
+
+		/* in doubled coordinates, pixel centers inside the ellipse */
+		for (r = 0; r < (int)h; r++) {
+			dy = 2 * r + 1 - (int)h;
+			for (c = 0; c < (int)w / 2; c++)
+				if ((long long)(2 * c + 1 - (int)w) * (2 * c + 1 - (int)w) * hh + dy * dy * ww <= ww * hh)
+					break;
+			if (c == (int)w / 2)
+				continue;
+			if (filled) {
+				shm_hline(drw->shm, x + c, x + w - 1 - c, y + r, pixel);
+			} else {
+				shm_hline(drw->shm, x + c, x + c, y + r, pixel);
+				shm_hline(drw->shm, x + w - 1 - c, x + w - 1 - c, y + r, pixel);
+			}
+		}
+		return;
+	}
+#endif /* XSHM */
 	XSetForeground(drw->dpy, drw->gc, invert ? drw->scheme[ColBg].pixel : drw->scheme[ColFg].pixel);
 	if (filled)
 		XFillArc(drw->dpy, drw->drawable, drw->gc, x, y, w, h, 0, 360*64);
@@ -284,17 +699,16 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 	if (!render) {
 		w = ~w;
 	} else {
-		XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
-		
 		if (rounded) {
-			XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h - rounded);
-			XSetForeground(drw->dpy, drw->gc, drw->scheme[ColFloat].pixel);
-			XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y + h - rounded, w, rounded);
-
+			fill(drw, x, y, w, h - rounded, drw->scheme[invert ? ColFg : ColBg].pixel);
+			fill(drw, x, y + h - rounded, w, rounded, drw->scheme[ColFloat].pixel);
 		} else {
-			XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
+			fill(drw, x, y, w, h, drw->scheme[invert ? ColFg : ColBg].pixel);
 		}
 
+#ifdef XSHM
+		if (!drw->shm)
+#endif /* XSHM */
 		d = XftDrawCreate(drw->dpy, drw->drawable,
 		                  DefaultVisual(drw->dpy, drw->screen),
 		                  DefaultColormap(drw->dpy, drw->screen));
@@ -347,6 +761,11 @@ drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lp
 
 				if (render) {
 					ty = y + (h - usedfont->h) / 2 + usedfont->xfont->ascent - (rounded ? (rounded / 2) : 0);
+#ifdef XSHM
+					if (drw->shm)
+						shm_string(drw, usedfont, x, ty, buf, len, &drw->scheme[invert ? ColBg : ColFg]);
+					else
+#endif /* XSHM */
 					XftDrawStringUtf8(d, &drw->scheme[invert ? ColBg : ColFg],
 					                  usedfont->xfont, x, ty, (XftChar8 *)buf, len);
 				}
@@ -423,20 +842,278 @@ drw_arrow(Drw *drw, int x, int y, unsigned int w, unsigned int h, int direction,
                 {x    , y + h  },
         };
 
+#ifdef XSHM
+        if (drw->shm) {
+                int r, xe;
+
+                /* the triangle is bounded by x and the two edges through the tip */
+                for (r = 0; r < (int)h; r++) {
+                        if (r < (int)hh)
+                                xe = x + (int)w * r / (int)hh;
+                        else
+                                xe = x + ((int)h - (int)hh ? (int)w * ((int)h - r) / ((int)h - (int)hh) : (int)w);
+                        shm_hline(drw->shm, x, xe, y + r, drw->scheme[ColBg].pixel);
+                }
+                return;
+        }
+#endif /* XSHM */
         XSetForeground(drw->dpy, drw->gc, drw->scheme[ColBg].pixel);
         XFillPolygon(drw->dpy, drw->drawable, drw->gc, points, 3, Nonconvex, CoordModeOrigin);
 }
 
+/* Box filter one _NET_WM_ICON image into a size x size square, keeping
+ * its aspect. Each destination pixel averages the source pixels it covers,
+ * in premultiplied alpha so transparent edges do not bleed dark. */
+Icn *
+drw_icon_create(Drw *drw, const unsigned long *data, unsigned int w, unsigned int h, unsigned int size)
+{
+	Icn *icon;
+	unsigned long a, r, g, b, p, n;
+	unsigned int dx, dy, sx, sy, sx0, sx1, sy0, sy1;
+
+	if (!drw || !data || !w || !h || !size)
+		return NULL;
+	icon = ecalloc(1, sizeof(Icn));
+	icon->ref = 1;
+	if (w > h) {
+		icon->w = size;
+		icon->h = MAX(1, h * size / w);
+	} else {
+		icon->w = MAX(1, w * size / h);
+		icon->h = size;
+	}
+	icon->argb = ecalloc(icon->w * icon->h, sizeof(uint32_t));
+
+	for (dy = 0; dy < icon->h; dy++) {
+		sy0 = dy * h / icon->h;
+		sy1 = MAX(sy0 + 1, (dy + 1) * h / icon->h);
+		for (dx = 0; dx < icon->w; dx++) {
+			sx0 = dx * w / icon->w;
+			sx1 = MAX(sx0 + 1, (dx + 1) * w / icon->w);
+			a = r = g = b = 0;
+			for (sy = sy0; sy < sy1; sy++) {
+				for (sx = sx0; sx < sx1; sx++) {
+					p = data[sy * w + sx];
+					n = p >> 24 & 0xff;
+					a += n;
+					r += (p >> 16 & 0xff) * n;
+					g += (p >> 8 & 0xff) * n;
+					b += (p & 0xff) * n;
+				}
+			}
+			n = (unsigned long)(sx1 - sx0) * (sy1 - sy0);
+			icon->argb[dy * icon->w + dx] = (a / n) << 24
+				| (r / 255 / n) << 16 | (g / 255 / n) << 8 | b / 255 / n;
+		}
+	}
+	return icon;
+}
+
+/* take another reference, for a user that may outlive the owner's */
+void
+drw_icon_hold(Icn *icon)
+{
+	__atomic_add_fetch(&icon->ref, 1, __ATOMIC_RELAXED);
+}
+
+/* drop a reference, the last one frees the icon */
+void
+drw_icon_free(Drw *drw, Icn *icon)
+{
+	if (!icon || __atomic_sub_fetch(&icon->ref, 1, __ATOMIC_ACQ_REL))
+		return;
+	if (icon->pic)
+		XRenderFreePicture(drw->dpy, icon->pic);
+	free(icon->argb);
+	free(icon);
+}
+
+static Picture
+icon_picture(Drw *drw, Icn *icon)
+{
+	XImage *img;
+	Pixmap pix;
+	GC gc;
+
+	if (icon->pic)
+		return icon->pic;
+	pix = XCreatePixmap(drw->dpy, drw->root, icon->w, icon->h, 32);
+	img = XCreateImage(drw->dpy, NULL, 32, ZPixmap, 0, (char *)icon->argb,
+	                   icon->w, icon->h, 32, 0);
+	gc = XCreateGC(drw->dpy, pix, 0, NULL);
+	XPutImage(drw->dpy, pix, gc, img, 0, 0, 0, 0, icon->w, icon->h);
+	XFreeGC(drw->dpy, gc);
+	img->data = NULL; /* still owned by the icon */
+	XDestroyImage(img);
+	/* the picture keeps the pixmap alive */
+	icon->pic = XRenderCreatePicture(drw->dpy, pix,
+		XRenderFindStandardFormat(drw->dpy, PictStandardARGB32), 0, NULL);
+	XFreePixmap(drw->dpy, pix);
+	return icon->pic;
+}
+
+void
+drw_icon(Drw *drw, int x, int y, Icn *icon)
+{
+	if (!drw || !icon)
+		return;
+
+#ifdef XSHM
+	if (drw->shm) {
+		struct Shm *s = drw->shm;
+		int stride = s->img->bytes_per_line / 4;
+		unsigned int r, c, a, p, q, rb, g;
+		uint32_t *row;
+
+		for (r = MAX(0, -y); r < icon->h && y + (int)r < s->img->height; r++) {
+			row = (uint32_t *)s->img->data + (y + r) * stride + x;
+			for (c = MAX(0, -x); c < icon->w && x + (int)c < s->img->width; c++) {
+				p = icon->argb[r * icon->w + c];
+				if (!(a = p >> 24))
+					continue;
+				/* over: src + dst * (255 - a), two channels at once */
+				q = row[c];
+				rb = ((q & 0xff00ff) * (255 - a) + 0x800080) >> 8 & 0xff00ff;
+				g = ((q & 0xff00) * (255 - a) + 0x8000) >> 8 & 0xff00;
+				row[c] = (p & 0xffffff) + rb + g;
+			}
+		}
+		return;
+	}
+#endif /* XSHM */
+	if (!drw->picture)
+		drw->picture = XRenderCreatePicture(drw->dpy, drw->drawable,
+			XRenderFindVisualFormat(drw->dpy, DefaultVisual(drw->dpy, drw->screen)), 0, NULL);
+	XRenderComposite(drw->dpy, PictOpOver, icon_picture(drw, icon), None, drw->picture,
+	                 0, 0, 0, 0, x, y, icon->w, icon->h);
+}
+
 void
 drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h)
 {
 	if (!drw)
 		return;
 
+#ifdef XSHM
+	if (drw->shm)
+		XShmPutImage(drw->dpy, win, drw->gc, drw->shm->img, x, y, x, y, w, h, False);
+	else
+#endif /* XSHM */
 	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
 	XSync(drw->dpy, False);
 }
 
+/* like drw_map, but copies to a different position and does not sync */
+void
+drw_copy(Drw *drw, Window win, int sx, int sy, unsigned int w, unsigned int h, int dx, int dy)
+{
+	if (!drw)
+		return;
+
+#ifdef XSHM
+	/* the buffer is shared, it must not change before the server read it */
+	if (drw->shm) {
+		XShmPutImage(drw->dpy, win, drw->gc, drw->shm->img, sx, sy, dx, dy, w, h, False);
+		XSync(drw->dpy, False);
+		return;
+	}
+#endif /* XSHM */
+	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, sx, sy, w, h, dx, dy);
+}
+
+/* Blit the sprite cached under key to x, y. Returns 0 if there is none of
+ * that size; the caller then draws it and hands it to drw_sprite_store() */
+int
+drw_sprite_draw(Drw *drw, unsigned long key, int x, int y, unsigned int w, unsigned int h)
+{
+	struct SpriteCache *sc;
+	int i;
+
+	if (!drw || !(sc = drw->sprites))
+		return 0;
+	for (i = 0; i < sc->n; i++)
+		if (sc->sprite[i].key == key && sc->sprite[i].w == w && sc->sprite[i].h == h)
+			break;
+	if (i == sc->n)
+		return 0;
+#ifdef XSHM
+	if (drw->shm) {
+		XImage *img = drw->shm->img;
+		int r, sx = sc->sprite[i].x, sy = sc->sprite[i].y;
+
+		if (x < 0 || y < 0 || x + w > img->width || y + h > img->height)
+			return 0;
+		for (r = 0; r < h; r++)
+			memcpy(img->data + (y + r) * img->bytes_per_line + x * 4,
+			       sc->buf + ((sy + r) * SPRITEW + sx) * 4, w * 4);
+		return 1;
+	}
+#endif /* XSHM */
+	XCopyArea(drw->dpy, sc->pix, drw->drawable, drw->gc, sc->sprite[i].x, sc->sprite[i].y, w, h, x, y);
+	return 1;
+}
+
+/* remember what was just drawn at x, y as key */
+void
+drw_sprite_store(Drw *drw, unsigned long key, int x, int y, unsigned int w, unsigned int h)
+{
+	struct SpriteCache *sc;
+	int i;
+
+	if (!drw || w > SPRITEW || h > SPRITEH || x < 0 || y < 0 || x + w > drw->w || y + h > drw->h)
+		return;
+	if (!(sc = drw->sprites)) {
+		sc = drw->sprites = ecalloc(1, sizeof(struct SpriteCache));
+#ifdef XSHM
+		if (drw->shm)
+			sc->buf = ecalloc(SPRITEW * SPRITEH, 4);
+		else
+#endif /* XSHM */
+		sc->pix = XCreatePixmap(drw->dpy, drw->root, SPRITEW, SPRITEH, DefaultDepth(drw->dpy, drw->screen));
+	}
+	if (sc->penx + w > SPRITEW) {
+		sc->penx = 0;
+		sc->peny += sc->rowh;
+		sc->rowh = 0;
+	}
+	if (sc->peny + h > SPRITEH || sc->n == SPRITES)
+		sc->n = sc->penx = sc->peny = sc->rowh = 0; /* full, start over */
+	i = sc->n++;
+	sc->sprite[i].key = key;
+	sc->sprite[i].x = sc->penx;
+	sc->sprite[i].y = sc->peny;
+	sc->sprite[i].w = w;
+	sc->sprite[i].h = h;
+#ifdef XSHM
+	if (drw->shm) {
+		XImage *img = drw->shm->img;
+		int r;
+
+		for (r = 0; r < h; r++)
+			memcpy(sc->buf + ((sc->peny + r) * SPRITEW + sc->penx) * 4,
+			       img->data + (y + r) * img->bytes_per_line + x * 4, w * 4);
+	} else
+#endif /* XSHM */
+	XCopyArea(drw->dpy, drw->drawable, sc->pix, drw->gc, x, y, w, h, sc->penx, sc->peny);
+	sc->penx += w;
+	sc->rowh = MAX(sc->rowh, (int)h);
+}
+
+/* forget every sprite, after theme, font or size changes */
+void
+drw_sprite_flush(Drw *drw)
+{
+	struct SpriteCache *sc;
+
+	if (!drw || !(sc = drw->sprites))
+		return;
+	if (sc->pix)
+		XFreePixmap(drw->dpy, sc->pix);
+	free(sc->buf);
+	free(sc);
+	drw->sprites = NULL;
+}
+
 unsigned int
 drw_fontset_getwidth(Drw *drw, const char *text)
 {
@@ -9,12 +9,20 @@ typedef struct Fnt {
 	unsigned int h;
 	XftFont *xfont;
 	FcPattern *pattern;
+	struct GlyphCache *glyphs; /* software renderer only */
 	struct Fnt *next;
 } Fnt;
 
 enum { ColFg, ColBg, ColBorder, ColFloat }; /* Clr scheme index */
 typedef XftColor Clr;
 
+typedef struct {
+	unsigned int w, h;
+	uint32_t *argb; /* premultiplied, w * h */
+	Picture pic;    /* uploaded on first use when drawing through Xlib */
+	int ref;        /* see drw_icon_hold() */
+} Icn;
+
 typedef struct {
 	unsigned int w, h;
 	Display *dpy;
@@ -24,6 +32,9 @@ typedef struct {
 	GC gc;
 	Clr *scheme;
 	Fnt *fonts;
+	struct Shm *shm; /* client-side buffer, NULL when drawing through Xlib */
+	struct SpriteCache *sprites;
+	Picture picture; /* drawable as render target, for icons */
 } Drw;
 
 /* Drawable abstraction */
@@ -51,9 +62,22 @@ void drw_setscheme(Drw *drw, Clr *scm);
 
 /* Drawing functions */
 void drw_rect(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int invert);
+void drw_fill(Drw *drw, int x, int y, unsigned int w, unsigned int h, int col);
 void drw_circ(Drw *drw, int x, int y, unsigned int w, unsigned int h, int filled, int invert);
 int drw_text(Drw *drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char *text, int invert, int rounded);
 void drw_arrow(Drw* drw, int x, int y, unsigned int w, unsigned int h, int direction, int slash);
 
+/* Icon abstraction */
+Icn *drw_icon_create(Drw *drw, const unsigned long *data, unsigned int w, unsigned int h, unsigned int size);
+void drw_icon_hold(Icn *icon);
+void drw_icon_free(Drw *drw, Icn *icon);
+void drw_icon(Drw *drw, int x, int y, Icn *icon);
+
+/* Sprite cache */
+int drw_sprite_draw(Drw *drw, unsigned long key, int x, int y, unsigned int w, unsigned int h);
+void drw_sprite_store(Drw *drw, unsigned long key, int x, int y, unsigned int w, unsigned int h);
+void drw_sprite_flush(Drw *drw);
+
 /* Map functions */
 void drw_map(Drw *drw, Window win, int x, int y, unsigned int w, unsigned int h);
+void drw_copy(Drw *drw, Window win, int sx, int sy, unsigned int w, unsigned int h, int dx, int dy);
@@ -20,18 +20,46 @@
  *
  * To understand everything else, start reading main().
  */
+#include <ctype.h>
 #include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <locale.h>
+#include <poll.h>
+#if defined(BARTHREAD) || defined(SCREENSHOT)
+#include <pthread.h>
+#endif /* BARTHREAD || SCREENSHOT */
 #include <signal.h>
+#include <spawn.h>
 #include <stdarg.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <sys/wait.h>
+#ifdef SCREENSHOT
+#ifdef XSHM
+#include <sys/ipc.h>
+#include <sys/shm.h>
+#endif /* XSHM */
+#include <zlib.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif /* __SSE2__ */
+#endif /* SCREENSHOT */
+#ifdef __linux__
+#include <sys/signalfd.h>
+#include <sys/timerfd.h>
+#endif /* __linux__ */
 #include <X11/cursorfont.h>
 #include <X11/keysym.h>
+#include <X11/XKBlib.h>
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
 
@@ -40,6 +68,20 @@
 #ifdef XINERAMA
 #include <X11/extensions/Xinerama.h>
 #endif /* XINERAMA */
+#ifdef RANDR
+#include <X11/extensions/Xrandr.h>
+#endif /* RANDR */
+#ifdef COMPOSITE
+#include <X11/extensions/Xcomposite.h>
+#include <X11/extensions/Xdamage.h>
+#include <X11/extensions/Xrender.h>
+#endif /* COMPOSITE */
+#ifdef PRESENT
+#include <X11/extensions/Xpresent.h>
+#endif /* PRESENT */
+#if defined(SCREENSHOT) && defined(XSHM)
+#include <X11/extensions/XShm.h>
+#endif /* SCREENSHOT && XSHM */
 #include <X11/Xft/Xft.h>
 
 #include "drw.h"
@@ -50,14 +92,42 @@
 #define CLEANMASK(mask)         (mask & ~(numlockmask|LockMask) & (ShiftMask|ControlMask|Mod1Mask|Mod2Mask|Mod3Mask|Mod4Mask|Mod5Mask))
 #define INTERSECT(x,y,w,h,m)    (MAX(0, MIN((x)+(w),(m)->wx+(m)->ww) - MAX((x),(m)->wx)) \
                                * MAX(0, MIN((y)+(h),(m)->wy+(m)->wh) - MAX((y),(m)->wy)))
-#define ISVISIBLE(C)            ((C->tags & C->mon->tagset[C->mon->seltags]) || C->issticky)
+#define ISVISIBLE(C)            (tsintersects(C->tags, C->mon->tagset[C->mon->seltags]) || C->issticky)
 #define HIDDEN(C)               ((getstate(C->win) == IconicState))
 #define LENGTH(X)               (sizeof X / sizeof X[0])
 #define MOUSEMASK               (BUTTONMASK|PointerMotionMask)
 #define WIDTH(X)                ((X)->w + 2 * (X)->bw)
 #define HEIGHT(X)               ((X)->h + 2 * (X)->bw)
-#define TAGMASK                 ((1 << LENGTH(tags)) - 1)
+#ifndef MAXTAGS
+#define MAXTAGS                 64
+#endif
+#define TAGBITS                 64 /* bits per Tagset word */
+#define TAGWORDS                ((MAXTAGS + TAGBITS - 1) / TAGBITS)
+#define TAGBIT(n)               {{ [(n) / TAGBITS] = 1ULL << ((n) % TAGBITS) }}
+#if TAGWORDS == 1
+#define ALLTAGS                 {{ ~0ULL }}
+#elif TAGWORDS == 2
+#define ALLTAGS                 {{ ~0ULL, ~0ULL }}
+#elif TAGWORDS == 3
+#define ALLTAGS                 {{ ~0ULL, ~0ULL, ~0ULL }}
+#elif TAGWORDS == 4
+#define ALLTAGS                 {{ ~0ULL, ~0ULL, ~0ULL, ~0ULL }}
+#else
+#error "MAXTAGS must not exceed 256"
+#endif
 #define TEXTW(X)                (drw_fontset_getwidth(drw, (X)) + lrpad)
+#define DRWTEXTW(D, X)          (drw_fontset_getwidth((D), (X)) + lrpad)
+#ifdef BARTHREAD
+#define XFTLOCK()               pthread_mutex_lock(&xftlock)
+#define XFTUNLOCK()             pthread_mutex_unlock(&xftlock)
+#else
+#define XFTLOCK()
+#define XFTUNLOCK()
+#endif /* BARTHREAD */
+#define SPRITEKEY(kind, v)      ((unsigned long)(kind) << 28 | (v)) /* see renderbar() */
+#define ROOTMASK                (SubstructureRedirectMask|SubstructureNotifyMask\
+                                |ButtonPressMask|EnterWindowMask|LeaveWindowMask\
+                                |StructureNotifyMask|PropertyChangeMask)
 
 #define MWM_HINTS_FLAGS_FIELD       0
 #define MWM_HINTS_DECORATIONS_FIELD 2
@@ -90,17 +160,25 @@ enum { SchemeNorm, SchemeSel, SchemeHid, SchemeTags, SchemeActive, SchemeAddActi
 enum { NetSupported, NetWMName, NetWMState, NetWMCheck,
        NetSystemTray, NetSystemTrayOP, NetSystemTrayOrientation, NetSystemTrayOrientationHorz,
        NetWMFullscreen, NetActiveWindow, NetWMWindowType,
-       NetWMWindowTypeDialog, NetClientList, NetLast }; /* EWMH atoms */
+       NetWMWindowTypeDialog, NetClientList, NetWMPid, NetWMIcon, NetLast }; /* EWMH atoms */
 enum { Manager, Xembed, XembedInfo, XLast }; /* Xembed atoms */
 enum { WMProtocols, WMDelete, WMState, WMTakeFocus, WMLast }; /* default atoms */
+enum { SpriteTag = 1, SpriteStartMenu, SpriteClose, SpriteShutdown }; /* bar sprites */
+enum { IdleIcons, IdleTitles, IdleLast }; /* idle tasks, most urgent first */
+enum { ShotClient, ShotMonitor, ShotRegion }; /* screenshot() targets */
 enum { ClkTagBar, ClkLtSymbol, ClkStatusText, ClkWinTitle,
        ClkClientWin, ClkRootWin, ClkCloseButton, ClkShutDown, ClkSideBar, ClkStartMenu, ClkLast }; /* clicks */
 
+typedef struct {
+	uint64_t w[TAGWORDS];
+} Tagset;
+
 typedef union {
 	int i;
 	unsigned int ui;
 	float f;
 	const void *v;
+	Tagset t;
 } Arg;
 
 typedef struct {
@@ -111,6 +189,59 @@ typedef struct {
 	const Arg arg;
 } Button;
 
+typedef struct {
+	Window win;           /* Present target on the monitor's CRTC */
+	int fd;               /* timerfd ticking at refresh without Present */
+	long period;          /* us between frames */
+	uint32_t serial;      /* last frame requested */
+	uint32_t done;        /* last frame completed */
+	uint64_t msc, ust;    /* counter and time of the last vblank */
+	int barpending;       /* bar repaint waiting for the next frame */
+	struct timespec bardue; /* paint the bar by then, even if no frame came */
+} FrameClock;
+
+/* one title slot of a bar snapshot */
+typedef struct {
+	char name[256];
+	Icn *icon; /* a reference of its own, dropped by freebar() */
+	int scm;
+	int sel;
+	int close, closescm; /* SpriteClose variant and scheme, sel only */
+} BarSlot;
+
+/* Everything the bar shows, taken on the event loop by barstate() so that
+ * renderbar() needs nothing else and can run on another connection */
+typedef struct {
+	Window win;
+	int ww;
+	int status;         /* draw stext, only on selmon */
+	int statusx, statusw; /* statusw is what the layout is based on */
+	char stext[1024];
+	int startmenuinvert;
+	int showalttag;
+	int ntags;
+	struct {
+		int idx, x, w, scm, urg, roundw;
+	} tag[MAXTAGS];
+	int ltx;
+	char ltsymbol[16];
+	int titlex, titlew;
+	int hint, hintw;    /* launch hint on an empty bar */
+	int nslots;
+	BarSlot slot[];
+} BarState;
+
+#ifdef BARTHREAD
+/* latest unrendered snapshot of a bar. Mailboxes are never freed, a
+ * monitor going away leaves its mailbox to the next one created */
+typedef struct BarMail BarMail;
+struct BarMail {
+	BarState *state; /* swapped atomically */
+	int used;        /* event loop only */
+	BarMail *next;   /* fixed once published */
+};
+#endif /* BARTHREAD */
+
 typedef struct Monitor Monitor;
 typedef struct Client Client;
 struct Client {
@@ -121,12 +252,33 @@ struct Client {
 	int oldx, oldy, oldw, oldh;
 	int basew, baseh, incw, inch, maxw, maxh, minw, minh;
 	int bw, oldbw;
-	unsigned int tags;
+	Tagset tags;
+	int userpos; /* WM_NORMAL_HINTS has USPosition, see place() */
 	int isfixed, isfloating, isurgent, neverfocus, oldstate, isfullscreen, isfakefullscreen, islocked, issticky;
 	Client *next;
 	Client *snext;
 	Monitor *mon;
 	Window win;
+	int trayx, trayw, trayh; /* systray icons: geometry last configured */
+	pid_t pgid; /* process group from _NET_WM_PID, 0 if unknown */
+	int nice, orignice;
+	int freeze, frozen;
+	struct timespec hidden; /* when c left the visible tags, zero while visible */
+	Icn *icon; /* _NET_WM_ICON scaled for the bar, NULL if none or evicted */
+	int hasicon; /* set while the window has a usable icon */
+	int iconstale; /* _NET_WM_ICON changed since it was scaled */
+	int titlewarm; /* name measured since it changed, see idletitles() */
+	unsigned long iconstamp; /* last drawn, the oldest icon is evicted first */
+	int ignoreunmap; /* unmaps we made and have not seen yet, see unmapnotify() */
+#ifdef COMPOSITE
+	XRenderPictFormat *format;
+	Damage damage;
+	XRectangle damaged; /* not yet copied to the thumbnail */
+	Pixmap thumb;
+	Picture thumbpict;
+	int thumbw, thumbh;
+	int redirected;
+#endif /* COMPOSITE */
 };
 
 typedef struct {
@@ -154,7 +306,7 @@ struct Monitor {
 	int wx, wy, ww, wh;   /* window area  */
 	unsigned int seltags;
 	unsigned int sellt;
-	unsigned int tagset[2];
+	Tagset tagset[2];
 	unsigned int activeoffset;
 	unsigned int titleoffset;
 	int showbar;
@@ -170,6 +322,17 @@ struct Monitor {
 	Window barwin;
 	const Layout *lt[2];
 	unsigned int showtags;
+	int changed;          /* geometry changed in updategeom() */
+	double refresh;       /* Hz, 0 if unknown */
+#ifdef RANDR
+	RROutput output;
+#endif /* RANDR */
+	FrameClock clock;
+	int gamemode;         /* a true fullscreen client has focus */
+	int deferred;         /* bar and title updates skipped in gamemode */
+#ifdef BARTHREAD
+	BarMail *mail;        /* to the bar renderer */
+#endif /* BARTHREAD */
 	Pertag *pertag;
 };
 
@@ -177,17 +340,121 @@ typedef struct {
 	const char *class;
 	const char *instance;
 	const char *title;
-	unsigned int tags;
+	Tagset tags;
 	int isfloating;
+	int freeze; /* SIGSTOP the process group while on hidden tags */
 	int monitor;
 } Rule;
 
+#ifdef COMPOSITE
+typedef struct {
+	Monitor *mon;
+	Window win;
+	Picture pict;
+	Client **clients;
+	int n, cols, rows, sel;
+} Overview;
+#endif /* COMPOSITE */
+
+typedef struct {
+	const char *name;
+	unsigned long n;
+	double sum, max; /* milliseconds */
+} Latency;
+
+typedef struct {
+	char *const *cmd; /* NULL when the slot is free */
+	pid_t pid;
+	int numeric; /* last argument is an increment, 2 if a bare sign */
+	int delta;
+	int pending;
+} CmdQueue;
+
+typedef struct {
+	int x0, x1, y0, y1; /* open, see place() */
+} Span;
+
+typedef struct {
+	int *x, *y; /* sorted, n each */
+	int n;
+	Monitor *mon;
+} Edges;
+
+typedef struct {
+	int (*step)(void); /* one small piece of work, 0 once there is none left */
+	int queued;
+} IdleTask;
+
+typedef struct {
+	const Key *key; /* held binding, NULL unless it accumulates */
+	KeyCode code;
+	int n; /* repeats not applied yet */
+	struct timespec due;
+} KeyRepeat;
+
+#ifdef SCREENSHOT
+typedef struct {
+	unsigned char *data; /* BGRX rows, owned by the encoder */
+	int w, h, stride;
+	int shm; /* data is an attached segment rather than malloc'd */
+	char path[PATH_MAX];
+} Shot;
+#endif /* SCREENSHOT */
+
 typedef struct Systray   Systray;
 struct Systray {
 	Window win;
 	Client *icons;
+	Monitor *mon;
+	int x, y;
+	unsigned int w; /* maintained by updatesystray() */
 };
 
+/* state handed over to the new binary on restart, see writestate().
+ * Bump STATEVERSION whenever the layout of these structs changes */
+#define STATEVERSION            2
+
+typedef struct {
+	int num;
+	int mx, my, mw, mh;
+	float mfact;
+	int nmaster;
+	unsigned int seltags, sellt;
+	Tagset tagset[2];
+	int lt[2]; /* indexes into layouts */
+	int showbar, showtags, overlaystatus;
+	Window overlay;
+	unsigned int curtag, prevtag;
+	int nmasters[MAXTAGS + 1];
+	float mfacts[MAXTAGS + 1];
+	unsigned int sellts[MAXTAGS + 1];
+	int ltidxs[MAXTAGS + 1][2];
+	int showbars[MAXTAGS + 1];
+} MonitorState;
+
+typedef struct {
+	Window win;
+	int mon, stackpos;
+	Tagset tags;
+	int x, y, w, h;
+	int sfx, sfy, sfw, sfh;
+	int oldx, oldy, oldw, oldh;
+	int bw, oldbw;
+	int isfloating, oldstate, isfullscreen, isfakefullscreen, islocked, issticky;
+	int freeze;
+	pid_t pgid;
+	int orignice;
+} ClientState;
+
+typedef struct {
+	char magic[8];
+	unsigned int version, ntags;
+	int nmons, nclients;
+	int selmon;
+	Window sel;
+	/* followed by nmons MonitorState and nclients ClientState */
+} StateHeader;
+
 /* function declarations */
 static void applyrules(Client *c);
 static int applysizehints(Client *c, int *x, int *y, int *w, int *h, int interact);
@@ -200,6 +467,14 @@ static void buttonpress(XEvent *e);
 static void checkotherwm(void);
 static void cleanup(void);
 static void cleanupmon(Monitor *mon);
+#ifdef BARTHREAD
+static void *barloop(void *arg);
+static void barstart(void);
+static void barpost(Monitor *m, BarState *b);
+static void barstop(void);
+#endif /* BARTHREAD */
+static BarState *barstate(Monitor *m);
+static Icn *clienticon(Client *c);
 static void clientmessage(XEvent *e);
 static void configure(Client *c);
 static void configurenotify(XEvent *e);
@@ -209,16 +484,19 @@ static void cyclelayout(const Arg *arg);
 static void destroynotify(XEvent *e);
 static void detach(Client *c);
 static void detachstack(Client *c);
+static void dispatch(XEvent *ev);
 static Monitor *dirtomon(int dir);
 static void drawbar(Monitor *m);
+static void drawstatusbar(Drw *d, Clr **scm, BarState *b);
 static void drawbars(void);
-static int drawstatusbar(Monitor *m, int bh, char* text);
 static void enternotify(XEvent *e);
 static void expose(XEvent *e);
 static void focus(Client *c);
 static void focusin(XEvent *e);
 static void focusmon(const Arg *arg);
 static void focusstack(const Arg *arg);
+static void freebar(Drw *d, BarState *b);
+static void freeicon(Client *c);
 static Atom getatomprop(Client *c, Atom prop);
 static int getrootptr(int *x, int *y);
 static long getstate(Window w);
@@ -227,45 +505,112 @@ static int gettextprop(Window w, Atom atom, char *text, unsigned int size);
 static void grabbuttons(Client *c, int focused);
 static void grabkeys(void);
 static void hide(Client *c);
+static void hideclients(Client **cs, int n);
 static void incnmaster(const Arg *arg);
 static void keypress(XEvent *e);
+static int keyrepeat(const Key *k, int n);
 static void killclient(const Arg *arg);
 static void manage(Window w, XWindowAttributes *wa);
+static void mapnotify(XEvent *e);
 static void mappingnotify(XEvent *e);
 static void maprequest(XEvent *e);
 static void monocle(Monitor *m);
 static void motionnotify(XEvent *e);
 static void movemouse(const Arg *arg);
+static void buildedges(Edges *e, Monitor *m, Client *skip);
+static int snapedge(const Edges *e, const int *a, int pos, int size);
 static void dragmouse(const Arg *arg);
 static void gesturemouse(const Arg *arg);
 static void dragrightmouse(const Arg *arg);
 static void drawwindow(const Arg *arg);
+#ifdef COMPOSITE
+static void damagenotify(XEvent *e);
+static void drawoverview(Overview *o, int i);
+static int overviewcell(Overview *o, int x, int y);
+static void overview(const Arg *arg);
+static void refreshthumbs(Overview *o, int draw);
+static void setredirect(Client *c, int redirect);
+static void trackdamage(Client *c, int track);
+static int updatethumb(Client *c, int tw, int th);
+#endif /* COMPOSITE */
+static void drawswitcher(Window win, Client **list, int n, int sel, int top, int rows, int w, const char *filter);
+static int fuzzymatch(const char *str, const char *pat);
+static int selectregion(int *rx, int *ry, int *rw, int *rh);
+static void screenshot(const Arg *arg);
+#ifdef SCREENSHOT
+static void putbe32(unsigned char *b, uint32_t v);
+static int shotchunk(FILE *f, const char *type, const unsigned char *data, size_t len);
+static void *shotencode(void *arg);
+static void shotrow(unsigned char *dst, const unsigned char *src, int n);
+#endif /* SCREENSHOT */
 static void waitforclickend(const Arg *arg);
 static void dragtag(const Arg *arg);
 static void moveresize(const Arg *arg);
 static void distributeclients(const Arg *arg);
 static void keyresize(const Arg *arg);
+static void moveby(int dir, int n);
+static void resizeby(int dir, int n);
 static void centerwindow();
 static Client *nexttiled(Client *c);
 static void pop(Client *);
+static void place(Client *c, Client *p);
+static void placeadd(int *mn, int *ad, int n, int l, int r, int ql, int qr, int v);
+static int placebound(const int *a, int n, int v);
+static int placecmp(const void *a, const void *b);
+static int placecmpy0(const void *a, const void *b);
+static int placecmpy1(const void *a, const void *b);
+static int placefind(const int *mn, const int *ad, int n, int l, int r, int ql, int qr, int target, int acc, int last);
 static void propertynotify(XEvent *e);
 static void quit(const Arg *arg);
+static void restart(const Arg *arg);
+static void execrestart(void);
+static ClientState *findstate(Window w);
+static int layoutindex(const Layout *l);
+static void readstate(const char *path);
+static void restorestate(void);
+static int writestate(char *path);
 static Monitor *recttomon(int x, int y, int w, int h);
 static void removesystrayicon(Client *i);
 static void resize(Client *c, int x, int y, int w, int h, int interact);
+static void renderbar(Drw *d, Clr **scm, BarState *b);
 static void resizebarwin(Monitor *m);
 static void resizeclient(Client *c, int x, int y, int w, int h);
 static void resizemouse(const Arg *arg);
 static void resizeaspectmouse(const Arg *arg);
 static void resizerequest(XEvent *e);
 static void restack(Monitor *m);
+static int framedelay(Monitor *m);
+static int bartimeout(void);
+static void clockupdate(Monitor *m);
+static void clockstart(Monitor *m);
+static void deferbar(Monitor *m);
+static void flushbars(void);
+static void flushrepeat(int force);
+static int repeattimeout(void);
+static void waitframe(Monitor *m);
+#ifdef PRESENT
+static void clocktick(Monitor *m);
+static Bool ispresentevent(Display *dpy, XEvent *ev, XPointer arg);
+static void presentnotify(XEvent *e);
+#endif /* PRESENT */
 static void animateclient(Client *c, int x, int y, int w, int h, int frames, int resetpos);
+static void animateclients(Client **cs, const int *x, const int *y, int n, int frames);
+static double elapsedms(const struct timespec *start);
+static int idleicons(void);
+static int idlepending(void);
+static void idlequeue(int task);
+static void idlerun(int fd);
+static int idletitles(void);
+static void latencyadd(Latency *l, const struct timespec *start);
+static void latencyreport(const Latency *l);
+static void reapchildren(void);
 static void run(void);
 static void runAutostart(void);
 static void scan(void);
 static int sendevent(Window w, Atom proto, int m, long d0, long d1, long d2, long d3, long d4);
 static void sendmon(Client *c, Monitor *m);
 static int gettagwidth();
+static Tagset occupied(Monitor *m);
 static int getxtag(int ix);
 static void setclientstate(Client *c, long state);
 static void setfocus(Client *c);
@@ -275,11 +620,33 @@ static void setmfact(const Arg *arg);
 static void setup(void);
 static void seturgent(Client *c, int urg);
 static void show(Client *c);
+static void showclients(Client **cs, int n);
 static void showhide(Client *c);
-static void sigchld(int unused);
+static void setupsigchld(void);
 static void spawn(const Arg *arg);
+static int statusw(Drw *d, const char *stext);
+static void switchtoclient(Client *c);
+static void switcher(const Arg *arg);
+static int cmdlen(char *const *cmd);
+static int cmdmatch(const CmdQueue *q, char *const *cmd, int numeric);
+static void cmdqueuerun(CmdQueue *q);
+static int isincrement(const char *s);
+static void queuecmd(const Arg *arg);
+static pid_t spawnv(char *const argv[]);
 static Monitor *systraytomon(Monitor *m);
 static void tag(const Arg *arg);
+static Tagset tagbit(unsigned int i);
+static Tagset tsand(Tagset a, Tagset b);
+static int tsany(Tagset t);
+static int tscount(Tagset t);
+static int tsequal(Tagset a, Tagset b);
+static int tsfirst(Tagset t);
+static int tsintersects(Tagset a, Tagset b);
+static Tagset tsor(Tagset a, Tagset b);
+static Tagset tsrotate(Tagset t, int n);
+static Tagset tsshift(Tagset t, int n);
+static int tstest(Tagset t, unsigned int i);
+static Tagset tsxor(Tagset a, Tagset b);
 static void followtag(const Arg *arg);
 static void followview(const Arg *arg);
 static void tagmon(const Arg *arg);
@@ -306,7 +673,20 @@ static void unmapnotify(XEvent *e);
 static void updatebarpos(Monitor *m);
 static void updatebars(void);
 static void updateclientlist(void);
+static void updategamemode(void);
+static void updatemonitors(void);
+#ifdef RANDR
+static int updaterandr(void);
+#endif /* RANDR */
+static void initprocess(Client *c);
+static void freezeclients(void);
+static int freezetimeout(void);
+static void thaw(Client *c);
+static void setnice(Client *c, int nice);
+static void updatepriorities(void);
+static int pgidcmp(const void *a, const void *b);
 static int updategeom(void);
+static void updateicon(Client *c);
 static void updatemotifhints(Client *c);
 static void updatenumlockmask(void);
 static void updatesizehints(Client *c);
@@ -322,8 +702,13 @@ static void warp(const Client *c);
 static void forcewarp(const Client *c);
 static void warpfocus();
 static void viewtoleft(const Arg *arg);
+static void viewby(int d);
 static void animleft(const Arg *arg);
 static void animright(const Arg *arg);
+static void slideview(const Arg *arg, void (*switchfn)(const Arg *), int dir);
+#ifdef COMPOSITE
+static Pixmap snapshotview(Monitor *m);
+#endif /* COMPOSITE */
 static void moveleft(const Arg *arg);
 static void viewtoright(const Arg *arg);
 static void moveright(const Arg *arg);
@@ -351,6 +736,7 @@ static void desktopset();
 static void createdesktop();
 static void createoverlay();
 static void shiftview(const Arg *arg);
+static void shiftby(int d, int n);
 
 /* variables */
 static Systray *systray =  NULL;
@@ -367,6 +753,7 @@ static int desktopicons = 0;
 static int newdesktop = 0;
 
 static int statuswidth = 0;
+static int labelw[MAXTAGS]; /* tag label widths, measured once in setup() */
 static int topdrag = 0;
 
 static int isdesktop = 0;
@@ -377,6 +764,48 @@ static int bh, blw = 0;      /* bar geometry */
 static int lrpad;            /* sum of left and right padding for text */
 static int (*xerrorxlib)(Display *, XErrorEvent *);
 static unsigned int numlockmask = 0;
+static int sigfd = -1;       /* readable when a child has exited */
+#ifndef __linux__
+static int sigpipe[2];
+#endif /* __linux__ */
+static posix_spawnattr_t spawnattr;
+static Latency spawnlatency = { "spawn" };
+static Latency freezelatency = { "freeze" };
+static Latency thawlatency = { "thaw" };
+static long rootmask; /* event mask currently selected on root */
+static int geomdirty; /* screen configuration changed, see updatemonitors() */
+#ifdef RANDR
+static int randr, randrevent;
+#endif /* RANDR */
+#ifdef PRESENT
+static int present, presentop; /* frame clock driven by vblank */
+#endif /* PRESENT */
+static int freezerules; /* some rule freezes, see setup() */
+static int minnice = 20; /* lowest nice level we could restore, see setup() */
+static int statusdeferred;
+#ifdef COMPOSITE
+static int composite; /* server supports Composite, Damage and Render */
+static int compositeop, damageop, damageevent, damageerror;
+static Atom rootpmapatom; /* wallpaper pixmap set by the background setter */
+#endif /* COMPOSITE */
+static CmdQueue cmdqueue[8];
+static IdleTask idletasks[IdleLast] = {
+	[IdleIcons] = { idleicons },
+	[IdleTitles] = { idletitles },
+};
+static KeyRepeat repeat;
+#ifdef BARTHREAD
+/* bars are drawn by barloop() on a connection of its own. Xft is not
+ * thread safe, so the event loop only shapes text under xftlock */
+static Display *bdpy;
+static Drw *bdrw;
+static Clr **bscheme;
+static BarMail *barmail;
+static int barstatusw; /* width of stext as last measured by the renderer */
+static int barpipe[2] = { -1, -1 }; /* wakes the renderer, closed to stop it */
+static pthread_t barthread;
+static pthread_mutex_t xftlock = PTHREAD_MUTEX_INITIALIZER;
+#endif /* BARTHREAD */
 static void (*handler[LASTEvent]) (XEvent *) = {
 	[ButtonPress] = buttonpress,
 	[ButtonRelease] = keyrelease,
@@ -390,6 +819,7 @@ static void (*handler[LASTEvent]) (XEvent *) = {
 	[KeyRelease] = keyrelease,
 	[KeyPress] = keypress,
 	[MappingNotify] = mappingnotify,
+	[MapNotify] = mapnotify,
 	[MapRequest] = maprequest,
 	[MotionNotify] = motionnotify,
 	[PropertyNotify] = propertynotify,
@@ -398,6 +828,14 @@ static void (*handler[LASTEvent]) (XEvent *) = {
 };
 static Atom wmatom[WMLast], netatom[NetLast], xatom[XLast], motifatom;
 static int running = 1;
+static Tagset tagmask; /* every configured tag */
+static int restarting; /* exec ourselves once run() returns */
+static char *wmpath; /* argv[0], for restarting */
+static StateHeader *state; /* handed over by the previous instance */
+static size_t statesize;
+static ClientState *restoring; /* snapshot of the client manage() adopts */
+static unsigned int iconcount; /* scaled icons held by clients */
+static unsigned long iconclock;
 static Cur *cursor[CurLast];
 static Clr **scheme;
 static Display *dpy;
@@ -417,15 +855,159 @@ struct Pertag {
 	int showbars[LENGTH(tags) + 1]; /* display bar for the current tag */
 };
 
-/* compile-time check if all tags fit into an unsigned int bit array. */
-struct NumTags { char limitexceeded[LENGTH(tags) > 31 ? -1 : 1]; };
+/* compile-time check if all tags fit into a Tagset. */
+struct NumTags { char limitexceeded[LENGTH(tags) > MAXTAGS ? -1 : 1]; };
 
 /* function implementations */
+
+/* tag bitset operations, all of them are O(TAGWORDS) */
+Tagset
+tagbit(unsigned int i)
+{
+	Tagset t = {{ 0 }};
+
+	if (i < MAXTAGS)
+		t.w[i / TAGBITS] = 1ULL << (i % TAGBITS);
+	return t;
+}
+
+Tagset
+tsand(Tagset a, Tagset b)
+{
+	int i;
+
+	for (i = 0; i < TAGWORDS; i++)
+		a.w[i] &= b.w[i];
+	return a;
+}
+
+Tagset
+tsor(Tagset a, Tagset b)
+{
+	int i;
+
+	for (i = 0; i < TAGWORDS; i++)
+		a.w[i] |= b.w[i];
+	return a;
+}
+
+Tagset
+tsxor(Tagset a, Tagset b)
+{
+	int i;
+
+	for (i = 0; i < TAGWORDS; i++)
+		a.w[i] ^= b.w[i];
+	return a;
+}
+
+int
+tsany(Tagset t)
+{
+	int i;
+
+	for (i = 0; i < TAGWORDS; i++)
+		if (t.w[i])
+			return 1;
+	return 0;
+}
+
+int
+tsequal(Tagset a, Tagset b)
+{
+	int i;
+
+	for (i = 0; i < TAGWORDS; i++)
+		if (a.w[i] != b.w[i])
+			return 0;
+	return 1;
+}
+
+int
+tsintersects(Tagset a, Tagset b)
+{
+	int i;
+
+	for (i = 0; i < TAGWORDS; i++)
+		if (a.w[i] & b.w[i])
+			return 1;
+	return 0;
+}
+
+int
+tstest(Tagset t, unsigned int i)
+{
+	return i < MAXTAGS && (t.w[i / TAGBITS] >> (i % TAGBITS) & 1);
+}
+
+int
+tscount(Tagset t)
+{
+	int i, n = 0;
+
+	for (i = 0; i < TAGWORDS; i++)
+		n += __builtin_popcountll(t.w[i]);
+	return n;
+}
+
+/* index of the lowest tag in t, -1 if t is empty */
+int
+tsfirst(Tagset t)
+{
+	int i;
+
+	for (i = 0; i < TAGWORDS; i++)
+		if (t.w[i])
+			return i * TAGBITS + __builtin_ctzll(t.w[i]);
+	return -1;
+}
+
+/* move every tag n places up (n < 0: down), tags shifted out are lost */
+Tagset
+tsshift(Tagset t, int n)
+{
+	Tagset r = {{ 0 }};
+	int i, words = (n < 0 ? -n : n) / TAGBITS, bits = (n < 0 ? -n : n) % TAGBITS;
+
+	if (n < 0) {
+		for (i = 0; i + words < TAGWORDS; i++) {
+			r.w[i] = t.w[i + words] >> bits;
+			if (bits && i + words + 1 < TAGWORDS)
+				r.w[i] |= t.w[i + words + 1] << (TAGBITS - bits);
+		}
+	} else {
+		for (i = TAGWORDS - 1; i >= words; i--) {
+			r.w[i] = t.w[i - words] << bits;
+			if (bits && i - words > 0)
+				r.w[i] |= t.w[i - words - 1] >> (TAGBITS - bits);
+		}
+	}
+	return r;
+}
+
+/* rotate t by n places within the configured tags */
+Tagset
+tsrotate(Tagset t, int n)
+{
+	int len = LENGTH(tags);
+
+	n %= len;
+	if (n < 0)
+		n += len;
+	t = tsand(t, tagmask);
+	return tsand(tsor(tsshift(t, n), tsshift(t, n - len)), tagmask);
+}
+
 static int combo = 0;
 
 void
 keyrelease(XEvent *e) {
 	combo = 0;
+	/* repeats not applied yet are dropped, the motion ends with the key */
+	if (e->type == KeyRelease && e->xkey.keycode == repeat.code) {
+		repeat.key = NULL;
+		repeat.n = 0;
+	}
 }
 
 int overlayexists() {
@@ -504,6 +1086,307 @@ double easeOutQuint( double t ) {
     return 1 + (--t) * t * t;
 }
 
+double
+elapsedms(const struct timespec *start)
+{
+	struct timespec now;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return (now.tv_sec - start->tv_sec) * 1e3 + (now.tv_nsec - start->tv_nsec) / 1e6;
+}
+
+/* scale one icon that changed since it was last drawn */
+int
+idleicons(void)
+{
+	Monitor *m;
+	Client *c;
+
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			if (c->iconstale) {
+				updateicon(c);
+				return 1;
+			}
+	return 0;
+}
+
+int
+idlepending(void)
+{
+	int i;
+
+	for (i = 0; i < IdleLast; i++)
+		if (idletasks[i].queued)
+			return 1;
+	return 0;
+}
+
+void
+idlequeue(int task)
+{
+	idletasks[task].queued = 1;
+}
+
+/* Run queued tasks, most urgent first, in steps until the slice is used up
+ * or fd becomes readable. Tasks are resumed from scratch in the next
+ * slice, so stopping between steps loses nothing */
+void
+idlerun(int fd)
+{
+	struct pollfd pfd = { .fd = fd, .events = POLLIN };
+	struct timespec start;
+	int i;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (i = 0; i < IdleLast; i++)
+		while (idletasks[i].queued) {
+			/* a step's round trip may have read input off the socket
+			 * into Xlib's queue already */
+			if (elapsedms(&start) >= idleslice || XEventsQueued(dpy, QueuedAlready)
+			|| poll(&pfd, 1, 0) > 0)
+				return;
+			idletasks[i].queued = idletasks[i].step();
+		}
+}
+
+/* measure one new title, so its glyphs and fallback fonts are loaded before
+ * the bar needs them */
+int
+idletitles(void)
+{
+	Monitor *m;
+	Client *c;
+
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			if (!c->titlewarm) {
+				c->titlewarm = 1;
+				drw_fontset_getwidth(drw, c->name);
+				return 1;
+			}
+	return 0;
+}
+
+void
+latencyadd(Latency *l, const struct timespec *start)
+{
+	double ms = elapsedms(start);
+
+	l->n++;
+	l->sum += ms;
+	if (ms > l->max)
+		l->max = ms;
+}
+
+void
+latencyreport(const Latency *l)
+{
+	if (l->n)
+		fprintf(stderr, "instantwm: %s latency: %lu samples, mean %.3f ms, max %.3f ms\n",
+			l->name, l->n, l->sum / l->n, l->max);
+}
+
+/* microseconds per frame on m */
+int
+framedelay(Monitor *m)
+{
+	return m->refresh >= 30 ? 1000000 / m->refresh : 15000;
+}
+
+/* (re)target m's frame clock after its geometry or refresh rate changed */
+void
+clockupdate(Monitor *m)
+{
+	FrameClock *fc = &m->clock;
+	XSetWindowAttributes wa = { .override_redirect = True };
+
+	fc->period = framedelay(m);
+	if (!fc->win) {
+		/* never mapped, Present only needs to know which CRTC covers it */
+		fc->win = XCreateWindow(dpy, root, m->mx, m->my, 1, 1, 0, CopyFromParent,
+				InputOutput, CopyFromParent, CWOverrideRedirect, &wa);
+#ifdef PRESENT
+		if (present)
+			XPresentSelectInput(dpy, fc->win, PresentCompleteNotifyMask);
+#endif /* PRESENT */
+	} else {
+		XMoveWindow(dpy, fc->win, m->mx, m->my);
+	}
+#ifdef PRESENT
+	if (present)
+		return;
+#endif /* PRESENT */
+#ifdef __linux__
+	if (fc->fd < 0)
+		fc->fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC);
+#endif /* __linux__ */
+	clockstart(m);
+}
+
+/* restart the frame timer when an animation begins, left running while
+ * idle it has long expired and the first frame would not wait at all */
+void
+clockstart(Monitor *m)
+{
+#ifdef __linux__
+	FrameClock *fc = &m->clock;
+	struct itimerspec its = {
+		.it_interval = { fc->period / 1000000, fc->period % 1000000 * 1000 },
+		.it_value = { fc->period / 1000000, fc->period % 1000000 * 1000 },
+	};
+
+	if (fc->fd >= 0)
+		timerfd_settime(fc->fd, 0, &its, NULL);
+#endif /* __linux__ */
+}
+
+/* block until m's next frame. Events that arrive meanwhile stay queued */
+void
+waitframe(Monitor *m)
+{
+	FrameClock *fc = &m->clock;
+#ifdef PRESENT
+	struct pollfd pfd = { .fd = ConnectionNumber(dpy), .events = POLLIN };
+	struct timespec start;
+	XEvent ev;
+	long left;
+
+	if (present) {
+		clocktick(m);
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		while ((int32_t)(fc->done - fc->serial) < 0) {
+			if (XCheckIfEvent(dpy, &ev, ispresentevent, NULL)) {
+				presentnotify(&ev);
+				continue;
+			}
+			/* a CRTC that went away never ticks, give up after two frames */
+			left = 2 * fc->period / 1000 - elapsedms(&start);
+			if (left <= 0 || poll(&pfd, 1, left) <= 0)
+				return;
+		}
+		return;
+	}
+#endif /* PRESENT */
+#ifdef __linux__
+	{
+		uint64_t ticks;
+
+		if (fc->fd >= 0 && read(fc->fd, &ticks, sizeof ticks) == sizeof ticks)
+			return;
+	}
+#endif /* __linux__ */
+	usleep(fc->period);
+}
+
+/* repaint m's bar on its next frame instead of right away, so bursts of
+ * status or title updates cost one paint per refresh */
+void
+deferbar(Monitor *m)
+{
+	FrameClock *fc = &m->clock;
+	long ns;
+
+	if (fc->barpending)
+		return;
+	fc->barpending = 1;
+	clock_gettime(CLOCK_MONOTONIC, &fc->bardue);
+	ns = fc->bardue.tv_nsec + fc->period * 1000;
+#ifdef PRESENT
+	if (present) {
+		clocktick(m);
+		ns += fc->period * 1000; /* fallback only, the notify comes first */
+	}
+#endif /* PRESENT */
+	fc->bardue.tv_sec += ns / 1000000000;
+	fc->bardue.tv_nsec = ns % 1000000000;
+}
+
+/* ms until the earliest deferred bar paint is due, -1 if none */
+int
+bartimeout(void)
+{
+	Monitor *m;
+	long ms, timeout = -1;
+
+	for (m = mons; m; m = m->next) {
+		if (!m->clock.barpending)
+			continue;
+		ms = MAX(-elapsedms(&m->clock.bardue), 0);
+		if (timeout < 0 || ms < timeout)
+			timeout = ms;
+	}
+	return timeout;
+}
+
+/* paint deferred bars whose frame did not come in time */
+void
+flushbars(void)
+{
+	Monitor *m;
+
+	for (m = mons; m; m = m->next)
+		if (m->clock.barpending && elapsedms(&m->clock.bardue) >= 0)
+			drawbar(m);
+}
+
+void
+flushrepeat(int force)
+{
+	int n = repeat.n;
+
+	if (!n || (!force && elapsedms(&repeat.due) < 0))
+		return;
+	repeat.n = 0;
+	keyrepeat(repeat.key, n);
+}
+
+int
+repeattimeout(void)
+{
+	return repeat.n ? MAX(-elapsedms(&repeat.due), 0) : -1;
+}
+
+#ifdef PRESENT
+/* ask for a notification at m's next vblank */
+void
+clocktick(Monitor *m)
+{
+	XPresentNotifyMSC(dpy, m->clock.win, ++m->clock.serial, 0, 1, 0);
+	XFlush(dpy);
+}
+
+Bool
+ispresentevent(Display *dpy, XEvent *ev, XPointer arg)
+{
+	return ev->type == GenericEvent && ev->xcookie.extension == presentop;
+}
+
+void
+presentnotify(XEvent *e)
+{
+	XGenericEventCookie *cookie = &e->xcookie;
+	XPresentCompleteNotifyEvent *ce;
+	Monitor *m;
+
+	if (!XGetEventData(dpy, cookie))
+		return;
+	ce = cookie->data;
+	if (cookie->evtype == PresentCompleteNotify)
+		for (m = mons; m; m = m->next) {
+			if (m->clock.win != ce->window)
+				continue;
+			m->clock.done = ce->serial_number;
+			m->clock.msc = ce->msc;
+			m->clock.ust = ce->ust;
+			if (m->clock.barpending)
+				drawbar(m);
+			break;
+		}
+	XFreeEventData(dpy, cookie);
+}
+#endif /* PRESENT */
+
 // move client to position within a set amount of frames
 void animateclient(Client *c, int x, int y, int w, int h, int frames, int resetpos)
 {
@@ -516,17 +1399,20 @@ void animateclient(Client *c, int x, int y, int w, int h, int frames, int resetp
 	oldx = c->x;
 	oldy = c->y;
 
-	if (animated && (abs(oldx - x) > 10 || abs(oldy - y) > 10 || abs(w - c->w) > 10 || abs(h - c->h) > 10)) {
+	if (animated && !c->mon->gamemode && (abs(oldx - x) > 10 || abs(oldy - y) > 10 || abs(w - c->w) > 10 || abs(h - c->h) > 10)) {
 		if (x == c->x && y == c->y && c->w < selmon->mw - 50) {
 			animateclient(c, c->x + (width - c->w), c->y + (height - c->h), 0, 0, frames, 0);
 		} else {
+			/* same duration at any refresh rate, one step per frame */
+			frames = frames * 15000 / framedelay(c->mon);
+			clockstart(c->mon);
 			while (time < frames)
 			{
 				resize(c,
 					oldx + easeOutQuint(((double)time/frames)) * (x - oldx),
 					oldy + easeOutQuint(((double)time/frames)) * (y - oldy), width, height, 1);
 				time++;
-				usleep(15000);
+				waitframe(c->mon);
 			}
 		}
 	}
@@ -538,6 +1424,43 @@ void animateclient(Client *c, int x, int y, int w, int h, int frames, int resetp
 
 }
 
+/* moves n clients to x[i], y[i] on one shared timeline, one frame at a
+ * time for all of them instead of one animation after the other */
+void
+animateclients(Client **cs, const int *x, const int *y, int n, int frames)
+{
+	int i, time, *ox, *oy;
+	double t;
+	Monitor *m;
+
+	if (!n)
+		return;
+	m = cs[0]->mon;
+	ox = ecalloc(2 * n, sizeof(int));
+	oy = ox + n;
+	for (i = 0; i < n; i++) {
+		ox[i] = cs[i]->x;
+		oy[i] = cs[i]->y;
+	}
+
+	if (animated && !m->gamemode) {
+		frames = frames * 15000 / framedelay(m);
+		clockstart(m);
+		for (time = 1; time < frames; time++) {
+			t = easeOutQuint((double)time / frames);
+			for (i = 0; i < n; i++)
+				if (abs(ox[i] - x[i]) > 10 || abs(oy[i] - y[i]) > 10)
+					resize(cs[i], ox[i] + t * (x[i] - ox[i]),
+						oy[i] + t * (y[i] - oy[i]), cs[i]->w, cs[i]->h, 1);
+			waitframe(m);
+		}
+	}
+
+	for (i = 0; i < n; i++)
+		resize(cs[i], x[i], y[i], cs[i]->w, cs[i]->h, 1);
+	free(ox);
+}
+
 void
 showoverlay() {
 	if (!overlayexists())
@@ -588,7 +1511,7 @@ hideoverlay() {
 		animateclient(c, c->x, 0 - c->h, 0, 0, 15, 0);
 
 	selmon->overlaystatus = 0;
-	selmon->overlay->tags = 0;
+	selmon->overlay->tags = (Tagset){{ 0 }};
 	focus(NULL);
 	arrange(selmon);
 
@@ -633,7 +1556,7 @@ applyrules(Client *c)
 
 	/* rule matching */
 	c->isfloating = 0;
-	c->tags = 0;
+	c->tags = (Tagset){{ 0 }};
 	XGetClassHint(dpy, c->win, &ch);
 	class    = ch.res_class ? ch.res_class : broken;
 	instance = ch.res_name  ? ch.res_name  : broken;
@@ -649,7 +1572,8 @@ applyrules(Client *c)
 				newdesktop = 1;
 			}
 			c->isfloating = r->isfloating;
-			c->tags |= r->tags;
+			c->freeze |= r->freeze;
+			c->tags = tsor(c->tags, r->tags);
 			for (m = mons; m && m->num != r->monitor; m = m->next);
 			if (m)
 				c->mon = m;
@@ -659,7 +1583,7 @@ applyrules(Client *c)
 		XFree(ch.res_class);
 	if (ch.res_name)
 		XFree(ch.res_name);
-	c->tags = c->tags & TAGMASK ? c->tags & TAGMASK : c->mon->tagset[c->mon->seltags];
+	c->tags = tsany(tsand(c->tags, tagmask)) ? tsand(c->tags, tagmask) : c->mon->tagset[c->mon->seltags];
 }
 
 int
@@ -775,7 +1699,8 @@ void resetcursor()
 void
 buttonpress(XEvent *e)
 {
-	unsigned int i, x, click, occ = 0;
+	unsigned int i, x, click;
+	Tagset occ;
 	Arg arg = {0};
 	Client *c;
 	Monitor *m;
@@ -792,16 +1717,13 @@ buttonpress(XEvent *e)
 	if (ev->window == selmon->barwin) {
 		i = 0;
 		x = startmenusize;
-		for (c = m->clients; c; c = c->next)
-			occ |= c->tags == 255 ? 0 : c->tags;
+		occ = tsor(occupied(m), m->tagset[m->seltags]);
 		do {
 			/* do not reserve space for vacant tags */
-			if (selmon->showtags){
-				if (!(occ & 1 << i || m->tagset[m->seltags] & 1 << i))
-					continue;
-			}
+			if (selmon->showtags && !tstest(occ, i))
+				continue;
 
-			x += TEXTW(tags[i]);	
+			x += labelw[i];	
 		} while (ev->x >= x && ++i < LENGTH(tags));
 		if (ev->x < startmenusize) {
 			click = ClkStartMenu;
@@ -809,7 +1731,7 @@ buttonpress(XEvent *e)
 			drawbar(selmon);
 		} else if (i < LENGTH(tags)) {
 			click = ClkTagBar;
-			arg.ui = 1 << i;
+			arg.t = tagbit(i);
 		} else if (ev->x < x + blw)
 			click = ClkLtSymbol;
 		else if (!selmon->sel && ev->x > x + blw &&  ev->x < x + blw + bh)
@@ -869,11 +1791,14 @@ checkotherwm(void)
 void
 cleanup(void)
 {
-	Arg a = {.ui = ~0};
+	Arg a = {.t = ALLTAGS};
 	Layout foo = { "", NULL };
 	Monitor *m;
 	size_t i;
 
+#ifdef BARTHREAD
+	barstop();
+#endif /* BARTHREAD */
 	view(&a);
 	selmon->lt[selmon->sellt] = &foo;
 	for (m = mons; m; m = m->next)
@@ -896,12 +1821,19 @@ cleanup(void)
 	XSync(dpy, False);
 	XSetInputFocus(dpy, PointerRoot, RevertToPointerRoot, CurrentTime);
 	XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
+	posix_spawnattr_destroy(&spawnattr);
+	latencyreport(&spawnlatency);
+	latencyreport(&freezelatency);
+	latencyreport(&thawlatency);
 }
 
 void
 cleanupmon(Monitor *mon)
 {
 	Monitor *m;
+#ifdef BARTHREAD
+	BarState *b;
+#endif /* BARTHREAD */
 
 	if (mon == mons)
 		mons = mons->next;
@@ -911,9 +1843,29 @@ cleanupmon(Monitor *mon)
 	}
 	XUnmapWindow(dpy, mon->barwin);
 	XDestroyWindow(dpy, mon->barwin);
+	if (mon->clock.win)
+		XDestroyWindow(dpy, mon->clock.win);
+	if (mon->clock.fd >= 0)
+		close(mon->clock.fd);
+#ifdef BARTHREAD
+	if ((b = __atomic_exchange_n(&mon->mail->state, NULL, __ATOMIC_ACQUIRE)))
+		freebar(drw, b);
+	mon->mail->used = 0;
+#endif /* BARTHREAD */
 	free(mon);
 }
 
+/* the scaled icon of c, fetched again if it was evicted */
+Icn *
+clienticon(Client *c)
+{
+	if (c->iconstale || (!c->icon && c->hasicon))
+		updateicon(c);
+	if (c->icon)
+		c->iconstamp = ++iconclock;
+	return c->icon;
+}
+
 void
 clientmessage(XEvent *e)
 {
@@ -943,7 +1895,7 @@ clientmessage(XEvent *e)
 			c->bw = 0;
 			c->isfloating = True;
 			/* reuse tags field as mapped status */
-			c->tags = 1;
+			c->tags = tagbit(0);
 			updatesizehints(c);
 			updatesystrayicongeom(c, wa.width, wa.height);
 			XAddToSaveSet(dpy, c->win);
@@ -958,8 +1910,8 @@ clientmessage(XEvent *e)
 			sendevent(c->win, netatom[Xembed], StructureNotifyMask, CurrentTime, XEMBED_WINDOW_ACTIVATE, 0 , systray->win, XEMBED_EMBEDDED_VERSION);
 			sendevent(c->win, netatom[Xembed], StructureNotifyMask, CurrentTime, XEMBED_MODALITY_ON, 0 , systray->win, XEMBED_EMBEDDED_VERSION);
 			XSync(dpy, False);
-			resizebarwin(selmon);
 			updatesystray();
+			resizebarwin(selmon);
 			setclientstate(c, NormalState);
 		}
 		return;
@@ -975,9 +1927,8 @@ clientmessage(XEvent *e)
 		if (c == selmon->overlay) {
 			showoverlay();
 		} else {
-			for (i = 0; i < LENGTH(tags) && !((1 << i) & c->tags); i++);
-			if (i < LENGTH(tags)) {
-				const Arg a = {.ui = 1 << i};
+			if ((i = tsfirst(tsand(c->tags, tagmask))) >= 0) {
+				const Arg a = {.t = tagbit(i)};
 				if (selmon != c->mon) {
 					unfocus(selmon->sel, 0);
 					selmon = c->mon;
@@ -1013,33 +1964,43 @@ configure(Client *c)
 void
 configurenotify(XEvent *e)
 {
-	Monitor *m;
-	Client *c;
 	XConfigureEvent *ev = &e->xconfigure;
 
-	/* TODO: updategeom handling sucks, needs to be simplified */
 	if (ev->window == root) {
-		int dirty = (sw != ev->width || sh != ev->height);
 		sw = ev->width;
 		sh = ev->height;
-		if (updategeom() || dirty) {
-			drw_resize(drw, sw, bh);
-			updatebars();
-			for (m = mons; m; m = m->next) {
-				if (c->isfakefullscreen){
-					XMoveResizeWindow(dpy, m->barwin, m->wx, m->by, m->ww, bh);
-				}else{
-					for (c = m->clients; c; c = c->next)
-						if (c->isfullscreen)
-							resizeclient(c, m->mx, m->my, m->mw, m->mh);
-					resizebarwin(m);
-				}
+		geomdirty = 1;
+	}
+}
 
-			}
-			focus(NULL);
-			arrange(NULL);
-		}
+/* called once the events of a screen change have been processed; only
+ * monitors whose geometry changed are laid out again */
+void
+updatemonitors(void)
+{
+	Monitor *m;
+	Client *c;
+
+	geomdirty = 0;
+	if (!updategeom() && drw->w == sw)
+		return;
+	drw_resize(drw, sw, bh);
+	updatebars();
+	for (m = mons; m; m = m->next) {
+		if (!m->changed)
+			continue;
+		for (c = m->clients; c; c = c->next)
+			if (c->isfullscreen && !c->isfakefullscreen)
+				resizeclient(c, m->mx, m->my, m->mw, m->mh);
+		resizebarwin(m);
+		clockupdate(m);
 	}
+	focus(NULL);
+	for (m = mons; m; m = m->next)
+		if (m->changed) {
+			m->changed = 0;
+			arrange(m);
+		}
 }
 
 void distributeclients(const Arg *arg) {
@@ -1053,8 +2014,8 @@ void distributeclients(const Arg *arg) {
 		if (tagcounter > 8) {
 			tagcounter = 0;
 		}
-		if (c && 1<<tagcounter & TAGMASK) {
-			c->tags = 1<<tagcounter & TAGMASK;
+		if (c && tstest(tagmask, tagcounter)) {
+			c->tags = tagbit(tagcounter);
 		}
 		tagcounter++;
 	}
@@ -1121,7 +2082,17 @@ createmon(void)
 	unsigned int i;
 
 	m = ecalloc(1, sizeof(Monitor));
-	m->tagset[0] = m->tagset[1] = 1;
+	m->tagset[0] = m->tagset[1] = tagbit(0);
+	m->clock.fd = -1;
+#ifdef BARTHREAD
+	for (m->mail = barmail; m->mail && m->mail->used; m->mail = m->mail->next);
+	if (!m->mail) {
+		m->mail = ecalloc(1, sizeof(BarMail));
+		m->mail->next = barmail;
+		__atomic_store_n(&barmail, m->mail, __ATOMIC_RELEASE);
+	}
+	m->mail->used = 1;
+#endif /* BARTHREAD */
 	m->mfact = mfact;
 	m->nmaster = nmaster;
 	m->showbar = showbar;
@@ -1173,8 +2144,8 @@ destroynotify(XEvent *e)
 		unmanage(c, 1);
 	else if ((c = wintosystrayicon(ev->window))) {
 		removesystrayicon(c);
-		resizebarwin(selmon);
 		updatesystray();
+		resizebarwin(selmon);
 	}
 }
 
@@ -1187,6 +2158,34 @@ detach(Client *c)
 	*tc = c->next;
 }
 
+void
+dispatch(XEvent *ev)
+{
+#ifdef PRESENT
+	if (present && ev->type == GenericEvent && ev->xcookie.extension == presentop) {
+		presentnotify(ev);
+		return;
+	}
+#endif /* PRESENT */
+	if (ev->type < LASTEvent) {
+		if (handler[ev->type])
+			handler[ev->type](ev); /* call handler */
+	}
+#ifdef RANDR
+	else if (randr && (ev->type == randrevent + RRScreenChangeNotify
+	|| ev->type == randrevent + RRNotify)) {
+		XRRUpdateConfiguration(ev);
+		sw = DisplayWidth(dpy, screen);
+		sh = DisplayHeight(dpy, screen);
+		geomdirty = 1;
+	}
+#endif /* RANDR */
+#ifdef COMPOSITE
+	else if (composite && ev->type == damageevent + XDamageNotify)
+		damagenotify(ev);
+#endif /* COMPOSITE */
+}
+
 void
 detachstack(Client *c)
 {
@@ -1216,28 +2215,24 @@ dirtomon(int dir)
 	return m;
 }
 
+/* width of stext without the 1px padding, ^f codes count, ^c/^d/^r do not */
 int
-drawstatusbar(Monitor *m, int bh, char* stext) {
-	int ret, i, w, x, len;
-	short isCode;
-	char *text;
-	char *p;
-
-	len = strlen(stext) + 1 ;
-	if (!(text = (char*) malloc(sizeof(char)*len)))
-		die("malloc");
-	p = text;
-	memcpy(text, stext, len);
+statusw(Drw *d, const char *stext)
+{
+	int i, w = 0, isCode = 0;
+	size_t len = strlen(stext) + 1;
+	char *text, *p;
 
-	/* compute width of the status text */
-	w = 0;
+	if (!(text = malloc(len)))
+		die("malloc");
+	p = memcpy(text, stext, len);
 	i = -1;
 	while (text[++i]) {
 		if (text[i] == '^') {
 			if (!isCode) {
 				isCode = 1;
 				text[i] = '\0';
-				w += TEXTW(text) - lrpad;
+				w += DRWTEXTW(d, text) - lrpad;
 				text[i] = '^';
 				if (text[++i] == 'f')
 					w += atoi(text + ++i);
@@ -1249,17 +2244,22 @@ drawstatusbar(Monitor *m, int bh, char* stext) {
 		}
 	}
 	if (!isCode)
-		w += TEXTW(text) - lrpad;
-	else
-		isCode = 0;
-	text = p;
-	statuswidth = w;
-	w += 2; /* 1px padding on both sides */
-	ret = x = m->ww - w - getsystraywidth();
-
-	drw_setscheme(drw, scheme[LENGTH(colors)]);
-	drw->scheme[ColFg] = scheme[SchemeNorm][ColFg];
-	drw_rect(drw, x, 0, w, bh, 1, 1);
+		w += DRWTEXTW(d, text) - lrpad;
+	free(p);
+	return w;
+}
+
+/* draw b->stext with its status codes, the text is consumed */
+void
+drawstatusbar(Drw *d, Clr **scm, BarState *b)
+{
+	int i, w, x = b->statusx;
+	short isCode = 0;
+	char *text = b->stext;
+
+	drw_setscheme(d, scm[LENGTH(colors)]);
+	d->scheme[ColFg] = scm[SchemeNorm][ColFg];
+	drw_rect(d, x, 0, b->statusw + 2, bh, 1, 1);
 	x++;
 
 	/* process status text */
@@ -1269,8 +2269,8 @@ drawstatusbar(Monitor *m, int bh, char* stext) {
 			isCode = 1;
 
 			text[i] = '\0';
-			w = TEXTW(text) - lrpad;
-			drw_text(drw, x, 0, w, bh, 0, text, 0, 0);
+			w = DRWTEXTW(d, text) - lrpad;
+			drw_text(d, x, 0, w, bh, 0, text, 0, 0);
 
 			x += w;
 
@@ -1280,10 +2280,10 @@ drawstatusbar(Monitor *m, int bh, char* stext) {
 					char buf[8];
 					memcpy(buf, (char*)text+i+1, 7);
 					buf[7] = '\0';
-					drw_clr_create(drw, &drw->scheme[ColBg], buf);
+					drw_clr_create(d, &d->scheme[ColBg], buf);
 					i += 7;
 				} else if (text[i] == 'd') {
-					drw->scheme[ColBg] = scheme[SchemeNorm][ColBg];
+					d->scheme[ColBg] = scm[SchemeNorm][ColBg];
 				} else if (text[i] == 'r') {
 					int rx = atoi(text + ++i);
 					while (text[++i] != ',');
@@ -1293,209 +2293,421 @@ drawstatusbar(Monitor *m, int bh, char* stext) {
 					while (text[++i] != ',');
 					int rh = atoi(text + ++i);
 
-					drw_rect(drw, rx + x, ry, rw, rh, 1, 0);
-				} else if (text[i] == 'f') {
-					x += atoi(text + ++i);
-				}
-			}
-
-			text = text + i + 1;
-			i=-1;
-			isCode = 0;
-		}
-	}
-
-	if (!isCode) {
-		w = TEXTW(text) - lrpad;
-		drw_text(drw, x, 0, w, bh, 0, text, 0, 0);
-	}
-
-	drw_setscheme(drw, scheme[SchemeNorm]);
-	free(p);
-
-	return ret;
-}
-
-void
-drawbar(Monitor *m)
-{
-
-	int x, w, sw = 0, n = 0, stw = 0, scm, wdelta, roundw;
-    unsigned int i, occ = 0, urg = 0;
-	Client *c;
-
-	if(showsystray && m == systraytomon(m))
-		stw = getsystraywidth();
+					drw_rect(d, rx + x, ry, rw, rh, 1, 0);
+				} else if (text[i] == 'f') {
+					x += atoi(text + ++i);
+				}
+			}
 
-	/* draw status first so it can be overdrawn by tags later */
-	if (m == selmon) { /* status is only drawn on selected monitor */
-		sw = m->ww - stw - drawstatusbar(m, bh, stext);
+			text = text + i + 1;
+			i=-1;
+			isCode = 0;
+		}
+	}
 
+	if (!isCode) {
+		w = DRWTEXTW(d, text) - lrpad;
+		drw_text(d, x, 0, w, bh, 0, text, 0, 0);
 	}
 
-	//draw start menu icon
+	drw_setscheme(d, scm[SchemeNorm]);
+}
 
-	int startmenuinvert = (selmon->gesture == 13);
-	drw_rect(drw, 0, 0, startmenusize, bh, 1, startmenuinvert ? 0:1);
-	drw_rect(drw, 5, 5, 14, 14, 1, startmenuinvert ? 1:0);
-	drw_rect(drw, 9, 9, 6, 6, 1, startmenuinvert ? 0:1);
-	drw_rect(drw, 19, 19, 6, 6, 1, startmenuinvert ? 1:0);
+/* Snapshot m for renderbar(). The geometry buttonpress() and friends
+ * test against is laid out here, from widths known without shaping text */
+BarState *
+barstate(Monitor *m)
+{
+	int x, w, sw = 0, n = 0, stw = 0, scm, roundw;
+	unsigned int i;
+	Tagset occ, shown, urg = {{ 0 }};
+	Client *c;
+	BarState *b;
+	BarSlot *s;
 
-	resizebarwin(m);
 	for (c = m->clients; c; c = c->next) {
 		if (ISVISIBLE(c))
 			n++;
-		occ |= c->tags == 255 ? 0 : c->tags;
-
 		if (c->isurgent)
-			urg |= c->tags;
+			urg = tsor(urg, c->tags);
+	}
+	b = ecalloc(1, sizeof(BarState) + n * sizeof(BarSlot));
+	b->win = m->barwin;
+	b->ww = m->ww;
+	if(showsystray && m == systraytomon(m))
+		stw = getsystraywidth();
+
+	/* status is only drawn on selected monitor */
+	if (m == selmon) {
+#ifdef BARTHREAD
+		/* measured by the renderer, see barloop() */
+		if (bdrw)
+			statuswidth = __atomic_load_n(&barstatusw, __ATOMIC_RELAXED);
+		else
+#endif /* BARTHREAD */
+		statuswidth = statusw(drw, stext);
+		b->status = 1;
+		b->statusw = statuswidth;
+		b->statusx = m->ww - statuswidth - 2 - getsystraywidth();
+		strncpy(b->stext, stext, sizeof b->stext - 1);
+		sw = m->ww - stw - b->statusx;
 	}
+	b->startmenuinvert = (selmon->gesture == 13);
+	b->showalttag = showalttag;
+
+	occ = occupied(m);
+	shown = tsor(occ, m->tagset[m->seltags]);
 	x = startmenusize;
 	for (i = 0; i < LENGTH(tags); i++) {
 
 		/* do not draw vacant tags */
-		if (selmon->showtags) {
-			if (!(occ & 1 << i || m->tagset[m->seltags] & 1 << i))
+		if (selmon->showtags && !tstest(shown, i))
 			continue;
-		}
 
-		w = TEXTW(tags[i]);
-		wdelta = showalttag ? abs(TEXTW(tags[i]) - TEXTW(tagsalt[i])) / 2 : 0;
+		w = labelw[i];
 
-		if (occ & 1 << i) {
-			if (m == selmon && selmon->sel && selmon->sel->tags & 1 << i) {
-				drw_setscheme(drw, scheme[SchemeActive]);
+		if (tstest(occ, i)) {
+			if (m == selmon && selmon->sel && tstest(selmon->sel->tags, i)) {
+				scm = SchemeActive;
 			} else {
-				if (m->tagset[m->seltags] & 1 << i) {
-					drw_setscheme(drw, scheme[SchemeAddActive]);
+				if (tstest(m->tagset[m->seltags], i)) {
+					scm = SchemeAddActive;
 				} else {
 					if(!selmon->showtags){
-						drw_setscheme(drw, scheme[SchemeTags]);
+						scm = SchemeTags;
 					} else {
-						drw_setscheme(drw, scheme[SchemeNorm]);
+						scm = SchemeNorm;
 					}
 				}
 			}
 		} else {
-			if (m->tagset[m->seltags] & 1 << i) {
-				drw_setscheme(drw, scheme[SchemeEmpty]);
+			if (tstest(m->tagset[m->seltags], i)) {
+				scm = SchemeEmpty;
 			} else {
-				drw_setscheme(drw, scheme[SchemeNorm]);
+				scm = SchemeNorm;
 			}
 		}
 
 		if (i == selmon->gesture - 1) {
 			roundw = 8;
 			if (bardragging) {
-				drw_setscheme(drw, scheme[SchemeHoverTags]);
+				scm = SchemeHoverTags;
 			} else {
-				if (drw->scheme == scheme[SchemeTags]) {
-							drw_setscheme(drw, scheme[SchemeHoverTags]);
-				} else if (drw->scheme == scheme[SchemeNorm]) {
-					drw_setscheme(drw, scheme[SchemeHover]);
+				if (scm == SchemeTags) {
+					scm = SchemeHoverTags;
+				} else if (scm == SchemeNorm) {
+					scm = SchemeHover;
 					roundw = 2;
 				}
 			}
-
-			drw_text(drw, x, 0, w, bh, lrpad / 2, (showalttag ? tagsalt[i] : tags[i]), urg & 1 << i, roundw);
-
 		} else {
-				drw_text(drw, x, 0, w, bh, lrpad / 2, (showalttag ? tagsalt[i] : tags[i]), urg & 1 << i, drw->scheme == scheme[SchemeNorm] ? 0 : 4);
-		
+			roundw = scm == SchemeNorm ? 0 : 4;
 		}
+
+		b->tag[b->ntags].idx = i;
+		b->tag[b->ntags].x = x;
+		b->tag[b->ntags].w = w;
+		b->tag[b->ntags].scm = scm;
+		b->tag[b->ntags].urg = tstest(urg, i);
+		b->tag[b->ntags].roundw = roundw;
+		b->ntags++;
 		x += w;
 	}
-	w = blw = 60;
-	drw_setscheme(drw, scheme[SchemeNorm]);
-	x = drw_text(drw, x, 0, w, bh, (w - TEXTW(m->ltsymbol)) * 0.5 + 10, m->ltsymbol, 0, 0);
+	b->ltx = x;
+	strncpy(b->ltsymbol, m->ltsymbol, sizeof b->ltsymbol - 1);
+	x += blw = 60;
+
+	w = m->ww - sw - x - stw;
+	b->titlex = x;
+	b->titlew = w;
+	if (w > bh) {
+		for (c = m->clients; c; c = c->next) {
+			if (!ISVISIBLE(c))
+				continue;
+			s = &b->slot[b->nslots++];
+			strncpy(s->name, c->name, sizeof s->name - 1);
+			if ((s->icon = clienticon(c)))
+				drw_icon_hold(s->icon);
+			if (m->sel == c) {
+				//background color rectangles to draw circle on
+				s->sel = 1;
+				s->scm = c->issticky ? SchemeActive : SchemeTags;
+				if (!c->islocked) {
+					s->closescm = SchemeClose;
+					s->close = selmon->gesture != 12 ? 0 : 1;
+				} else {
+					s->closescm = SchemeAddActive;
+					s->close = 2;
+				}
+				m->activeoffset = selmon->mx + x;
+			} else if (HIDDEN(c)) {
+				s->scm = SchemeHid;
+			} else {
+				s->scm = c->issticky ? SchemeAddActive : SchemeNorm;
+			}
+			x += (1.0 / (double)n) * w;
+		}
+		b->hint = !n && !selmon->clients;
+		b->hintw = selmon->btw;
+	}
 
-	if ((w = m->ww - sw - x - stw) > bh) {
-		if (n > 0) {
-			for (c = m->clients; c; c = c->next) {
-				if (!ISVISIBLE(c))
-					continue;
-				if (m->sel == c) {
+	m->bt = n;
+	m->btw = w;
+	return b;
+}
 
-					//background color rectangles to draw circle on
-					if (!c->issticky)
-						drw_setscheme(drw, scheme[SchemeTags]);
-					else
-						drw_setscheme(drw, scheme[SchemeActive]);
+void
+freebar(Drw *d, BarState *b)
+{
+	int i;
 
-					if (TEXTW(c->name) < (1.0 / (double)n) * w - 64){
-						drw_text(drw, x, 0, (1.0 / (double)n) * w, bh, ((1.0 / (double)n) * w - TEXTW(c->name)) * 0.5, c->name, 0, 4);
-					} else {
-						drw_text(drw, x, 0, (1.0 / ((double)n) * w), bh, lrpad / 2 + 20, c->name, 0, 4);
-					}
+	for (i = 0; i < b->nslots; i++)
+		drw_icon_free(d, b->slot[i].icon);
+	free(b);
+}
 
-					// render close button
-					if (!c->islocked) {
-						drw_setscheme(drw, scheme[SchemeClose]);
-						if (selmon->gesture != 12) {
-							XSetForeground(drw->dpy, drw->gc, drw->scheme[ColBg].pixel);
-							XFillRectangle(drw->dpy, drw->drawable, drw->gc, x +  6, 4, 20, 16);
-							XSetForeground(drw->dpy, drw->gc, drw->scheme[ColFloat].pixel);
-							XFillRectangle(drw->dpy, drw->drawable, drw->gc, x + 6, 20, 20, 4);
-						} else {
-							XSetForeground(drw->dpy, drw->gc, drw->scheme[ColFg].pixel);
-							XFillRectangle(drw->dpy, drw->drawable, drw->gc, x +  6, 2, 20, 16);
-							XSetForeground(drw->dpy, drw->gc, drw->scheme[ColBg].pixel);
-							XFillRectangle(drw->dpy, drw->drawable, drw->gc, x + 6, 18, 20, 6);
-						}
-					} else {
-						drw_setscheme(drw, scheme[SchemeAddActive]);
-						XSetForeground(drw->dpy, drw->gc, drw->scheme[ColBg].pixel);
-						XFillRectangle(drw->dpy, drw->drawable, drw->gc, x +  6, 4, 20, 16);
-						XSetForeground(drw->dpy, drw->gc, drw->scheme[ColFloat].pixel);
-						XFillRectangle(drw->dpy, drw->drawable, drw->gc, x + 6, 20, 20, 4);
+/* draw a snapshot taken by barstate() with d and its schemes */
+void
+renderbar(Drw *d, Clr **scm, BarState *b)
+{
+	int i, x, w, pad, iw, n = b->nslots, titlewidth;
+	unsigned long key;
+	BarSlot *s;
 
-					}
+	if (d->w < b->ww)
+		drw_resize(d, b->ww, bh);
 
-					m->activeoffset = selmon->mx + x;
+	/* draw status first so it can be overdrawn by tags later */
+	if (b->status)
+		drawstatusbar(d, scm, b);
 
-				x += (1.0 / (double)n) * w;
-					
-				} else {
-					if (HIDDEN(c)) {
-						scm = SchemeHid;
-					} else{
-						if (!c->issticky)
-							scm = SchemeNorm;
-						else
-							scm = SchemeAddActive;
+	//draw start menu icon
+	drw_setscheme(d, scm[SchemeNorm]);
+	if (!drw_sprite_draw(d, SPRITEKEY(SpriteStartMenu, b->startmenuinvert), 0, 0, startmenusize, bh)) {
+		drw_rect(d, 0, 0, startmenusize, bh, 1, b->startmenuinvert ? 0:1);
+		drw_rect(d, 5, 5, 14, 14, 1, b->startmenuinvert ? 1:0);
+		drw_rect(d, 9, 9, 6, 6, 1, b->startmenuinvert ? 0:1);
+		drw_rect(d, 19, 19, 6, 6, 1, b->startmenuinvert ? 1:0);
+		drw_sprite_store(d, SPRITEKEY(SpriteStartMenu, b->startmenuinvert), 0, 0, startmenusize, bh);
+	}
+
+	for (i = 0; i < b->ntags; i++) {
+		/* every label state is rendered once, after that it is a blit */
+		drw_setscheme(d, scm[b->tag[i].scm]);
+		key = SPRITEKEY(SpriteTag, b->tag[i].idx << 12 | b->tag[i].scm << 6
+			| b->tag[i].urg << 5 | b->showalttag << 4 | b->tag[i].roundw);
+		if (!drw_sprite_draw(d, key, b->tag[i].x, 0, b->tag[i].w, bh)) {
+			drw_text(d, b->tag[i].x, 0, b->tag[i].w, bh, lrpad / 2,
+				b->showalttag ? tagsalt[b->tag[i].idx] : tags[b->tag[i].idx],
+				b->tag[i].urg, b->tag[i].roundw);
+			drw_sprite_store(d, key, b->tag[i].x, 0, b->tag[i].w, bh);
+		}
+	}
+	w = 60;
+	drw_setscheme(d, scm[SchemeNorm]);
+	drw_text(d, b->ltx, 0, w, bh, (w - DRWTEXTW(d, b->ltsymbol)) * 0.5 + 10, b->ltsymbol, 0, 0);
+
+	x = b->titlex;
+	if ((w = b->titlew) > bh) {
+		if (n > 0) {
+			for (s = b->slot; s < b->slot + n; s++) {
+				drw_setscheme(d, scm[s->scm]);
+				iw = s->icon ? s->icon->w + lrpad / 4 : 0;
+				if (s->sel) {
+					if (DRWTEXTW(d, s->name) + iw < (1.0 / (double)n) * w - 64){
+						pad = ((1.0 / (double)n) * w - DRWTEXTW(d, s->name) - iw) * 0.5 + iw;
+					} else {
+						pad = lrpad / 2 + 20 + iw;
 					}
-					drw_setscheme(drw, scheme[scm]);
-					if (TEXTW(c->name) < (1.0 / (double)n) * w){
-						drw_text(drw, x, 0, (1.0 / (double)n) * w, bh, ((1.0 / (double)n) * w - TEXTW(c->name)) * 0.5, c->name, 0, 0);
+				} else {
+					if (DRWTEXTW(d, s->name) + iw < (1.0 / (double)n) * w){
+						pad = ((1.0 / (double)n) * w - DRWTEXTW(d, s->name) - iw) * 0.5 + iw;
 					} else {
-						drw_text(drw, x, 0, (1.0 / (double)n) * w, bh, lrpad / 2, c->name, 0, 0);	
+						pad = lrpad / 2 + iw;
+					}
+				}
+				drw_text(d, x, 0, (1.0 / (double)n) * w, bh, pad, s->name, 0, s->sel ? 4 : 0);
+				if (s->icon)
+					drw_icon(d, x + pad - iw, (bh - s->icon->h) / 2, s->icon);
+
+				// render close button
+				if (s->sel) {
+					drw_setscheme(d, scm[s->closescm]);
+					if (s->close == 1) {
+						if (!drw_sprite_draw(d, SPRITEKEY(SpriteClose, 1), x + 6, 2, 20, 22)) {
+							drw_fill(d, x + 6, 2, 20, 16, ColFg);
+							drw_fill(d, x + 6, 18, 20, 6, ColBg);
+							drw_sprite_store(d, SPRITEKEY(SpriteClose, 1), x + 6, 2, 20, 22);
+						}
+					} else if (!drw_sprite_draw(d, SPRITEKEY(SpriteClose, s->close), x + 6, 4, 20, 20)) {
+						drw_fill(d, x + 6, 4, 20, 16, ColBg);
+						drw_fill(d, x + 6, 20, 20, 4, ColFloat);
+						drw_sprite_store(d, SPRITEKEY(SpriteClose, s->close), x + 6, 4, 20, 20);
 					}
-					x += (1.0 / (double)n) * w;
-
 				}
+				x += (1.0 / (double)n) * w;
 			}
 		} else {
-			drw_setscheme(drw, scheme[SchemeNorm]);
-			drw_rect(drw, x, 0, w, bh, 1, 1);
-			//drw_setscheme(drw, scheme[SchemeTags]);
+			drw_setscheme(d, scm[SchemeNorm]);
+			drw_rect(d, x, 0, w, bh, 1, 1);
 			// render shutdown button
-			drw_text(drw, x, 0, bh, bh, lrpad / 2, "", 0, 0);
+			if (!drw_sprite_draw(d, SPRITEKEY(SpriteShutdown, 0), x, 0, bh, bh)) {
+				drw_text(d, x, 0, bh, bh, lrpad / 2, "", 0, 0);
+				drw_sprite_store(d, SPRITEKEY(SpriteShutdown, 0), x, 0, bh, bh);
+			}
 			// display help message if no application is opened
-			if (!selmon->clients) {
-				int titlewidth =
-					TEXTW("Press space to launch an application") < selmon->btw ? TEXTW("Press space to launch an application") : (selmon->btw - bh);
-				drw_text(drw, x + bh + ((selmon->btw - bh) - titlewidth + 1) / 2, 0, titlewidth, bh, 0, "Press space to launch an application", 0, 0);
+			if (b->hint) {
+				titlewidth = DRWTEXTW(d, "Press space to launch an application") < b->hintw
+					? DRWTEXTW(d, "Press space to launch an application") : (b->hintw - bh);
+				drw_text(d, x + bh + ((b->hintw - bh) - titlewidth + 1) / 2, 0, titlewidth, bh, 0, "Press space to launch an application", 0, 0);
 			}
 		}
 	}
-	
-    // prevscheme = scheme[SchemeNorm];
-	drw_setscheme(drw, scheme[SchemeNorm]);
 
-	m->bt = n;
-	m->btw = w;
-	drw_map(drw, m->barwin, 0, 0, m->ww, bh);
+	drw_setscheme(d, scm[SchemeNorm]);
+	drw_map(d, b->win, 0, 0, b->ww, bh);
+}
+
+void
+drawbar(Monitor *m)
+{
+	BarState *b;
+
+	m->clock.barpending = 0; /* a deferred repaint is served by this one */
+	if (m->gamemode) {
+		m->deferred = 1;
+		return;
+	}
+	resizebarwin(m);
+	b = barstate(m);
+#ifdef BARTHREAD
+	if (bdrw) {
+		barpost(m, b);
+		return;
+	}
+#endif /* BARTHREAD */
+	renderbar(drw, scheme, b);
+	freebar(drw, b);
+}
+
+#ifdef BARTHREAD
+/* Draw whatever snapshots are waiting, the latest one of each bar. All
+ * text is shaped here, the event loop never waits for fontconfig */
+void *
+barloop(void *arg)
+{
+	char buf[64];
+	BarMail *mb;
+	BarState *b;
+	XEvent ev;
+	int w;
+
+	while (read(barpipe[0], buf, sizeof buf) > 0) {
+		for (mb = __atomic_load_n(&barmail, __ATOMIC_ACQUIRE); mb; mb = mb->next) {
+			if (!(b = __atomic_exchange_n(&mb->state, NULL, __ATOMIC_ACQUIRE)))
+				continue;
+			/* held per bar, so the switcher and the overview wait
+			 * for one paint at most, not for the whole drain */
+			XFTLOCK();
+			if (b->status && (w = statusw(bdrw, b->stext)) != b->statusw) {
+				/* laid out around a stale status width, have the
+				 * event loop redo it through an expose */
+				__atomic_store_n(&barstatusw, w, __ATOMIC_RELAXED);
+				memset(&ev, 0, sizeof ev);
+				ev.xexpose.type = Expose;
+				ev.xexpose.window = b->win;
+				XSendEvent(bdpy, b->win, False, ExposureMask, &ev);
+				XFlush(bdpy);
+			} else {
+				renderbar(bdrw, bscheme, b);
+			}
+			freebar(bdrw, b);
+			XFTUNLOCK();
+		}
+	}
+	return NULL;
+}
+
+/* hand b to the renderer, replacing a snapshot it did not get to yet */
+void
+barpost(Monitor *m, BarState *b)
+{
+	BarState *old;
+
+	if ((old = __atomic_exchange_n(&m->mail->state, b, __ATOMIC_ACQ_REL)))
+		freebar(drw, old);
+	/* a full pipe already has the renderer running */
+	if (write(barpipe[1], "", 1) < 0 && errno != EAGAIN)
+		fprintf(stderr, "instantwm: bar renderer: %s\n", strerror(errno));
+}
+
+/* Set up the renderer with its own connection, fonts and schemes. Bars
+ * are drawn on the event loop as before if any of it fails */
+void
+barstart(void)
+{
+	sigset_t all, old;
+	size_t i;
+
+	if (!(bdpy = XOpenDisplay(NULL))) {
+		fputs("instantwm: bar renderer: cannot open display\n", stderr);
+		return;
+	}
+	fcntl(ConnectionNumber(bdpy), F_SETFD, FD_CLOEXEC);
+	bdrw = drw_create(bdpy, screen, root, sw, bh);
+	if (!drw_fontset_create(bdrw, fonts, LENGTH(fonts)) || pipe(barpipe) < 0)
+		goto fail;
+	fcntl(barpipe[0], F_SETFD, FD_CLOEXEC);
+	fcntl(barpipe[1], F_SETFD, FD_CLOEXEC);
+	fcntl(barpipe[1], F_SETFL, O_NONBLOCK);
+	bscheme = ecalloc(LENGTH(colors) + 1, sizeof(Clr *));
+	bscheme[LENGTH(colors)] = drw_scm_create(bdrw, colors[0], 4);
+	for (i = 0; i < LENGTH(colors); i++)
+		bscheme[i] = drw_scm_create(bdrw, colors[i], 4);
+
+	/* signals are for the event loop's signalfd only */
+	sigfillset(&all);
+	pthread_sigmask(SIG_SETMASK, &all, &old);
+	i = pthread_create(&barthread, NULL, barloop, NULL);
+	pthread_sigmask(SIG_SETMASK, &old, NULL);
+	if (!i)
+		return;
+
+	for (i = 0; i < LENGTH(colors) + 1; i++)
+		free(bscheme[i]);
+	free(bscheme);
+	close(barpipe[0]);
+	close(barpipe[1]);
+fail:
+	fputs("instantwm: bar renderer: drawing bars on the event loop\n", stderr);
+	drw_fontset_free(bdrw->fonts);
+	drw_free(bdrw);
+	XCloseDisplay(bdpy);
+	bdrw = NULL;
+	bdpy = NULL;
+}
+
+/* join the renderer, snapshots it left behind go with their monitors */
+void
+barstop(void)
+{
+	size_t i;
+
+	if (!bdrw)
+		return;
+	close(barpipe[1]);
+	pthread_join(barthread, NULL);
+	close(barpipe[0]);
+	for (i = 0; i < LENGTH(colors) + 1; i++)
+		free(bscheme[i]);
+	free(bscheme);
+	drw_fontset_free(bdrw->fonts);
+	drw_free(bdrw);
+	XCloseDisplay(bdpy);
+	bdrw = NULL;
+	bdpy = NULL;
 }
+#endif /* BARTHREAD */
 
 void
 drawbars(void)
@@ -1567,6 +2779,9 @@ focus(Client *c)
 	selmon->sel = c;
 	if (selmon->gesture != 11 && selmon->gesture)
 		selmon->gesture = 0;
+	updategamemode();
+	updatepriorities();
+	updatesystray(); /* follows the selected monitor */
 	drawbars();
 	if (!c){
 		if (!isdesktop) {
@@ -1629,6 +2844,16 @@ focusstack(const Arg *arg)
 	}
 }
 
+void
+freeicon(Client *c)
+{
+	if (!c->icon)
+		return;
+	drw_icon_free(drw, c->icon);
+	c->icon = NULL;
+	iconcount--;
+}
+
 Atom
 getatomprop(Client *c, Atom prop)
 {
@@ -1683,11 +2908,7 @@ getstate(Window w)
 unsigned int
 getsystraywidth()
 {
-	unsigned int w = 0;
-	Client *i;
-	if(showsystray)
-		for(i = systray->icons; i; w += i->w + systrayspacing, i = i->next) ;
-	return w ? w + systrayspacing : 1;
+	return showsystray && systray ? systray->w : 1;
 }
 
 int
@@ -1771,34 +2992,48 @@ void
 hide(Client *c) {
 	if (!c || HIDDEN(c))
 		return;
+	hideclients(&c, 1);
+}
+
+/* hides n clients that are all shown, with one animation and one
+ * arrange per monitor */
+void
+hideclients(Client **cs, int n)
+{
+	Client *c;
+	Monitor *m;
+	int i, *x, *y, *ty;
+
+	if (!n)
+		return;
+	x = ecalloc(3 * n, sizeof(int));
+	y = x + n;
+	ty = y + n;
+	for (i = 0; i < n; i++) {
+		x[i] = cs[i]->x;
+		y[i] = cs[i]->y;
+		ty[i] = bh - cs[i]->h + 40;
+	}
 
-	int x, y, wi, h;
-	x = c->x;
-	y = c->y;
-	wi = c->w;
-	h = c->h;
+	animateclients(cs, x, ty, n, 10);
 
-	animateclient(c, c->x, bh - c->h + 40, 0, 0, 10, 0);
-
-	Window w = c->win;
-	static XWindowAttributes ra, ca;
-
-	// more or less taken directly from blackbox's hide() function
-	XGrabServer(dpy);
-	XGetWindowAttributes(dpy, root, &ra);
-	XGetWindowAttributes(dpy, w, &ca);
-	// prevent UnmapNotify events
-	XSelectInput(dpy, root, ra.your_event_mask & ~SubstructureNotifyMask);
-	XSelectInput(dpy, w, ca.your_event_mask & ~StructureNotifyMask);
-	XUnmapWindow(dpy, w);
-	setclientstate(c, IconicState);
-	XSelectInput(dpy, root, ra.your_event_mask);
-	XSelectInput(dpy, w, ca.your_event_mask);
-	XUngrabServer(dpy);
-	resize(c, x, y, wi, h, 0);
-
-	focus(c->snext);
-	arrange(c->mon);
+	for (i = 0; i < n; i++) {
+		cs[i]->ignoreunmap++;
+		XUnmapWindow(dpy, cs[i]->win);
+		setclientstate(cs[i], IconicState);
+	}
+	for (i = 0; i < n; i++)
+		resize(cs[i], x[i], y[i], cs[i]->w, cs[i]->h, 0);
+	free(x);
+
+	for (c = cs[0]->snext; c && HIDDEN(c); c = c->snext);
+	focus(c);
+	for (m = mons; m; m = m->next)
+		for (i = 0; i < n; i++)
+			if (cs[i]->mon == m) {
+				arrange(m);
+				break;
+			}
 }
 
 void
@@ -1825,15 +3060,34 @@ keypress(XEvent *e)
 {
 
 	unsigned int i;
+	long ns;
 	KeySym keysym;
 	XKeyEvent *ev;
 
 	ev = &e->xkey;
+	/* with detectable autorepeat a held key presses again without
+	 * releasing, count those and apply them once a frame */
+	if (repeat.key && ev->keycode == repeat.code
+	&& CLEANMASK(repeat.key->mod) == CLEANMASK(ev->state)) {
+		if (!repeat.n++) {
+			clock_gettime(CLOCK_MONOTONIC, &repeat.due);
+			ns = repeat.due.tv_nsec + framedelay(selmon) * 1000L;
+			repeat.due.tv_sec += ns / 1000000000;
+			repeat.due.tv_nsec = ns % 1000000000;
+		}
+		return;
+	}
+	flushrepeat(1);
+	repeat.key = NULL;
+	repeat.code = ev->keycode;
+
 	keysym = XKeycodeToKeysym(dpy, (KeyCode)ev->keycode, 0);
 	for (i = 0; i < LENGTH(keys); i++) {
 		if (keysym == keys[i].keysym
 		&& CLEANMASK(keys[i].mod) == CLEANMASK(ev->state)
 		&& keys[i].func) {
+			if (keyrepeat(&keys[i], 0))
+				repeat.key = &keys[i];
 			keys[i].func(&(keys[i].arg));
 		}
 
@@ -1843,8 +3097,11 @@ keypress(XEvent *e)
 		for (i = 0; i < LENGTH(dkeys); i++) {
 			if (keysym == dkeys[i].keysym
 			&& CLEANMASK(dkeys[i].mod) == CLEANMASK(ev->state)
-			&& dkeys[i].func)
+			&& dkeys[i].func) {
+				if (keyrepeat(&dkeys[i], 0))
+					repeat.key = &dkeys[i];
 				dkeys[i].func(&(dkeys[i].arg));
+			}
 
 		}
 
@@ -1852,6 +3109,40 @@ keypress(XEvent *e)
 
 }
 
+/* applies n presses of k as a single step. Returns 0 when k has no
+ * such form, in which case nothing is done; n == 0 only asks */
+int
+keyrepeat(const Key *k, int n)
+{
+	Arg a = k->arg;
+
+	if (k->func != moveresize && k->func != keyresize
+	&& k->func != shiftview && k->func != viewtoleft && k->func != viewtoright
+	&& (k->func != setmfact || k->arg.f >= 1.0))
+		return 0;
+	if (!n)
+		return 1;
+	if (k->func == moveresize) {
+		moveby(a.i, n);
+	} else if (k->func == keyresize) {
+		resizeby(a.i, n);
+	} else if (k->func == setmfact) {
+		/* go as far as the limits allow instead of dropping the batch */
+		for (; n > 1; n--) {
+			a.f = k->arg.f * n;
+			if (a.f + selmon->mfact >= 0.1 && a.f + selmon->mfact <= 0.9)
+				break;
+		}
+		a.f = k->arg.f * n;
+		setmfact(&a);
+	} else if (k->func == shiftview) {
+		shiftby(a.i, n);
+	} else {
+		viewby(k->func == viewtoleft ? -n : n);
+	}
+	return 1;
+}
+
 void
 killclient(const Arg *arg)
 {
@@ -1869,11 +3160,23 @@ killclient(const Arg *arg)
 	}
 }
 
+void
+mapnotify(XEvent *e)
+{
+	Client *c;
+	XMapEvent *ev = &e->xmap;
+
+	/* any unmap of ours came before this on the same stream, so a count
+	 * left over now is for an unmap the server never reported */
+	if (ev->event == root && (c = wintoclient(ev->window)))
+		c->ignoreunmap = 0;
+}
+
 void
 manage(Window w, XWindowAttributes *wa)
 {
 
-	if (desktopicons) {
+	if (desktopicons && !state) {
 		int x, y;
 		Monitor *tempmon;
 		if (getrootptr(&x, &y)) {
@@ -1901,23 +3204,64 @@ manage(Window w, XWindowAttributes *wa)
 	c->oldbw = wa->border_width;
 
 	updatetitle(c);
-	if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
-		c->mon = t->mon;
-		c->tags = t->tags;
+	c->iconstale = 1; /* scaled when first drawn or when idle */
+	idlequeue(IdleIcons);
+	if ((restoring = findstate(w))) {
+		/* adopted from the previous instance, rules were already applied */
+		for (c->mon = mons; c->mon && c->mon->num != restoring->mon; c->mon = c->mon->next);
+		if (!c->mon)
+			c->mon = selmon;
+		c->tags = tsany(tsand(restoring->tags, tagmask)) ? tsand(restoring->tags, tagmask)
+			: c->mon->tagset[c->mon->seltags];
+		c->x = restoring->x;
+		c->y = restoring->y;
+		c->w = restoring->w;
+		c->h = restoring->h;
+		c->sfx = restoring->sfx;
+		c->sfy = restoring->sfy;
+		c->sfw = restoring->sfw;
+		c->sfh = restoring->sfh;
+		c->oldx = restoring->oldx;
+		c->oldy = restoring->oldy;
+		c->oldw = restoring->oldw;
+		c->oldh = restoring->oldh;
+		c->oldbw = restoring->oldbw;
+		c->isfloating = restoring->isfloating;
+		c->oldstate = restoring->oldstate;
+		c->isfullscreen = restoring->isfullscreen;
+		c->isfakefullscreen = restoring->isfakefullscreen;
+		c->islocked = restoring->islocked;
+		c->issticky = restoring->issticky;
+		c->freeze = restoring->freeze;
+		if ((c->pgid = restoring->pgid))
+			c->nice = c->orignice = restoring->orignice;
+		else if (schedfocus || freezerules)
+			initprocess(c);
 	} else {
-		c->mon = selmon;
-		applyrules(c);
+		if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
+			c->mon = t->mon;
+			c->tags = t->tags;
+		} else {
+			c->mon = selmon;
+			applyrules(c);
+		}
+		if (schedfocus || freezerules)
+			initprocess(c);
 	}
 
-	if (c->x + WIDTH(c) > c->mon->mx + c->mon->mw)
-		c->x = c->mon->mx + c->mon->mw - WIDTH(c);
-	if (c->y + HEIGHT(c) > c->mon->my + c->mon->mh)
-		c->y = c->mon->my + c->mon->mh - HEIGHT(c);
-	c->x = MAX(c->x, c->mon->mx);
-	/* only fix client y-offset, if the client center might cover the bar */
-	c->y = MAX(c->y, ((c->mon->by == c->mon->my) && (c->x + (c->w / 2) >= c->mon->wx)
-		&& (c->x + (c->w / 2) < c->mon->wx + c->mon->ww)) ? bh : c->mon->my);
-	c->bw = borderpx;
+	if (restoring) {
+		c->bw = restoring->bw;
+	} else {
+		if (c->x + WIDTH(c) > c->mon->mx + c->mon->mw)
+			c->x = c->mon->mx + c->mon->mw - WIDTH(c);
+		if (c->y + HEIGHT(c) > c->mon->my + c->mon->mh)
+			c->y = c->mon->my + c->mon->mh - HEIGHT(c);
+		c->x = MAX(c->x, c->mon->mx);
+		/* only fix client y-offset, if the client center might cover the bar */
+		c->y = MAX(c->y, ((c->mon->by == c->mon->my) && (c->x + (c->w / 2) >= c->mon->wx)
+			&& (c->x + (c->w / 2) < c->mon->wx + c->mon->ww)) ? bh : c->mon->my);
+		c->bw = borderpx;
+	}
 
 	wc.border_width = c->bw;
 	XConfigureWindow(dpy, w, CWBorderWidth, &wc);
@@ -1933,9 +3277,21 @@ manage(Window w, XWindowAttributes *wa)
 	c->sfw = c->w;
 	c->sfh = c->h;
 	XSelectInput(dpy, w, EnterWindowMask|FocusChangeMask|PropertyChangeMask|StructureNotifyMask);
+#ifdef COMPOSITE
+	if (composite) {
+		c->format = XRenderFindVisualFormat(dpy, wa->visual);
+		setredirect(c, !c->isfullscreen || c->isfakefullscreen);
+	}
+#endif /* COMPOSITE */
 	grabbuttons(c, 0);
-	if (!c->isfloating)
+	if (!c->isfloating && !restoring)
 		c->isfloating = c->oldstate = trans != None || c->isfixed;
+	if (!restoring && !c->userpos && !c->isfullscreen
+	&& (c->isfloating || !c->mon->lt[c->mon->sellt]->arrange)) {
+		place(c, t);
+		c->sfx = c->x;
+		c->sfy = c->y;
+	}
 	if (c->isfloating)
 		XRaiseWindow(dpy, c->win);
 	attach(c);
@@ -1957,7 +3313,7 @@ manage(Window w, XWindowAttributes *wa)
 		createdesktop();
 	}
 
-	if (animated) {
+	if (animated && !c->mon->gamemode && !restoring) {
 		resizeclient(c, c->x, c->y - 70, c->w, c->h);
 		animateclient(c,c->x, c->y + 70, 0,0,7,0);
 		if (c->w > selmon->mw - 30 || c->h > selmon->mh - 30)
@@ -1984,8 +3340,8 @@ maprequest(XEvent *e)
 	Client *i;
 	if ((i = wintosystrayicon(ev->window))) {
 		sendevent(i->win, netatom[Xembed], StructureNotifyMask, CurrentTime, XEMBED_WINDOW_ACTIVATE, 0, systray->win, XEMBED_EMBEDDED_VERSION);
-		resizebarwin(selmon);
 		updatesystray();
+		resizebarwin(selmon);
 	}
 
 	if (!XGetWindowAttributes(dpy, ev->window, &wa))
@@ -2047,7 +3403,7 @@ motionnotify(XEvent *e)
 					i = 0;
 					int x = selmon->mx + startmenusize;
 					do {
-						x += TEXTW(tags[i]);
+						x += labelw[i];
 					} while (ev->x_root >= x && ++i < LENGTH(tags));
 					
 					if (i != selmon->gesture - 1) {
@@ -2060,7 +3416,7 @@ motionnotify(XEvent *e)
 			// perform gesture over layout indicator to bring up switcher
 			if (ev->y_root == 0 && ev->state & ShiftMask) {
 				if (ev->x_root == 0 && !topdrag) {
-					spawn(&((Arg) { .v = caretinstantswitchcmd }));
+					switcher(NULL);
 					topdrag = 1;
 				}
 				if (!tagwidth)
@@ -2125,14 +3481,66 @@ motionnotify(XEvent *e)
 	mon = m;
 }
 
+/* Collect the work area edges of m and both edges of its visible clients
+ * but skip, sorted, for snapedge() to search while a drag lasts */
+void
+buildedges(Edges *e, Monitor *m, Client *skip)
+{
+	Client *t;
+	int n = 1;
+
+	for (t = m->clients; t; t = t->next)
+		if (t != skip && ISVISIBLE(t) && !HIDDEN(t))
+			n++;
+	free(e->x);
+	free(e->y);
+	e->x = ecalloc(2 * n, sizeof(int));
+	e->y = ecalloc(2 * n, sizeof(int));
+	e->n = 0;
+	e->mon = m;
+	e->x[e->n] = m->wx;
+	e->y[e->n++] = m->wy;
+	e->x[e->n] = m->wx + m->ww;
+	e->y[e->n++] = m->wy + m->wh;
+	for (t = m->clients; t; t = t->next) {
+		if (t == skip || !ISVISIBLE(t) || HIDDEN(t))
+			continue;
+		e->x[e->n] = t->x;
+		e->y[e->n++] = t->y;
+		e->x[e->n] = t->x + WIDTH(t);
+		e->y[e->n++] = t->y + HEIGHT(t);
+	}
+	qsort(e->x, e->n, sizeof(int), placecmp);
+	qsort(e->y, e->n, sizeof(int), placecmp);
+}
+
+/* pos moved onto the edge in a, one of e's arrays, that is closest to
+ * either side of a span of size at pos, if that is within snap */
+int
+snapedge(const Edges *e, const int *a, int pos, int size)
+{
+	int i, j, d = INT_MAX;
+
+	for (j = 0; j < 2; j++) {
+		i = placebound(a, e->n, pos + j * size);
+		if (i < e->n && abs(a[i] - pos - j * size) < abs(d))
+			d = a[i] - pos - j * size;
+		if (i > 0 && abs(a[i - 1] - pos - j * size) < abs(d))
+			d = a[i - 1] - pos - j * size;
+	}
+	return abs(d) < (int)snap ? pos + d : pos;
+}
+
 void
 movemouse(const Arg *arg)
 {
-	int x, y, ocx, ocy, nx, ny, ti, tx, occ, tagclient, colorclient, tagx, notfloating;
+	int x, y, ocx, ocy, nx, ny, ti, tx, tagclient, colorclient, tagx, notfloating;
+	Tagset occ;
 	Client *c;
 	Monitor *m;
 	XEvent ev;
 	Time lasttime = 0;
+	Edges edges = { 0 };
 	tagclient = 0;
 	notfloating = 0;
 	if (!(c = selmon->sel))
@@ -2183,14 +3591,10 @@ movemouse(const Arg *arg)
 
 			}
 
-			if (abs(selmon->wx - nx) < snap)
-				nx = selmon->wx;
-			else if (abs((selmon->wx + selmon->ww) - (nx + WIDTH(c))) < snap)
-				nx = selmon->wx + selmon->ww - WIDTH(c);
-			if (abs(selmon->wy - ny) < snap)
-				ny = selmon->wy;
-			else if (abs((selmon->wy + selmon->wh) - (ny + HEIGHT(c))) < snap)
-				ny = selmon->wy + selmon->wh - HEIGHT(c);
+			if (edges.mon != selmon)
+				buildedges(&edges, selmon, c);
+			nx = snapedge(&edges, edges.x, nx, WIDTH(c));
+			ny = snapedge(&edges, edges.y, ny, HEIGHT(c));
 			if (!c->isfloating && selmon->lt[selmon->sellt]->arrange
 			&& (abs(nx - c->x) > snap || abs(ny - c->y) > snap)) {
 				if (animated) {
@@ -2228,6 +3632,8 @@ movemouse(const Arg *arg)
 			break;
 		}
 	} while (ev.type != ButtonRelease);
+	free(edges.x);
+	free(edges.y);
 
 	bardragging = 0;
 	if (ev.xmotion.y_root < bh) {
@@ -2237,21 +3643,18 @@ movemouse(const Arg *arg)
 		if (ev.xmotion.x_root < selmon->mx + tagwidth && ev.xmotion.x_root > selmon->mx) {
 			ti = 0;
 			tx = startmenusize;
-			for (c = selmon->clients; c; c = c->next)
-				occ |= c->tags == 255 ? 0 : c->tags;
+			occ = tsor(occupied(selmon), selmon->tagset[selmon->seltags]);
 			do {
 				// do not reserve space for vacant tags
-				if (selmon->showtags){
-					if (!(occ & 1 << ti || m->tagset[m->seltags] & 1 << ti))
-						continue;
-				}
-				tx += TEXTW(tags[ti]);	
+				if (selmon->showtags && !tstest(occ, ti))
+					continue;
+				tx += labelw[ti];	
 			} while (ev.xmotion.x_root >= tx + selmon->mx && ++ti < LENGTH(tags));
 			selmon->sel->isfloating = 0;
 			if (ev.xmotion.state & ShiftMask)
-				tag(&((Arg) { .ui = 1 << ti }));
+				tag(&((Arg) { .t = tagbit(ti) }));
 			else
-				followtag(&((Arg) { .ui = 1 << ti }));
+				followtag(&((Arg) { .t = tagbit(ti) }));
 			tagclient = 1;
 
 		} else if (ev.xmotion.x_root > selmon->mx + selmon->mw - 50 && ev.xmotion.x_root < selmon->mx + selmon->mw ) {
@@ -2329,9 +3732,9 @@ gesturemouse(const Arg *arg)
 			lasttime = ev.xmotion.time;
 			if (abs(lasty - ev.xmotion.y_root) > selmon->mh / 30) {
 				if (ev.xmotion.y_root < lasty)
-					spawn(&((Arg) { .v = upvol }));
+					queuecmd(&((Arg) { .v = upvol }));
 				else
-					spawn(&((Arg) { .v = downvol }));
+					queuecmd(&((Arg) { .v = downvol }));
 				lasty = ev.xmotion.y_root;
 				if (!tmpactive)
 					tmpactive = 1;
@@ -2344,7 +3747,7 @@ gesturemouse(const Arg *arg)
 			spawn(&((Arg) { .v = onboardcmd }));
 	} else {
 		if (!tmpactive && abs(ev.xmotion.y_root - y) < 100) {
-			spawn(&((Arg) { .v = caretinstantswitchcmd }));
+			switcher(NULL);
 		}
 	}
 
@@ -2536,113 +3939,409 @@ dragrightmouse(const Arg *arg)
 		zoom(NULL);
 	}
 
-	XUngrabPointer(dpy, CurrentTime);
-}
-
-void waitforclickend(const Arg *arg)
-{
-	XEvent ev;
-	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
-	None, cursor[CurResize]->cursor, CurrentTime) != GrabSuccess)
-	return;
+	XUngrabPointer(dpy, CurrentTime);
+}
+
+void waitforclickend(const Arg *arg)
+{
+	XEvent ev;
+	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
+	None, cursor[CurResize]->cursor, CurrentTime) != GrabSuccess)
+	return;
+	do {
+		XMaskEvent(dpy, MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
+		switch(ev.type) {
+		case ConfigureRequest:
+		case Expose:
+		case MapRequest:
+			handler[ev.type](&ev);
+			break;
+		}
+	} while (ev.type != ButtonRelease);
+	XUngrabPointer(dpy, CurrentTime);
+
+}
+
+
+void
+drawwindow(const Arg *arg)
+{
+	int x, y, width, height;
+	Monitor *m;
+	Client *c;
+
+	if (!selmon->sel || !selectregion(&x, &y, &width, &height))
+		return;
+	if (!(c = selmon->sel))
+		return;
+
+	if (width > 50 && height > 50 && x > -40 && y > -40 && width < selmon->mw + 40 && height < selmon->mh + 40 &&
+	(abs(c->w - width) > 20 || abs(c->h - height) > 20 || abs(c->x - x) > 20 || abs(c->y - y) > 20)) {
+		if ((m = recttomon(x, y, width, height)) != selmon) {
+			sendmon(c, m);
+			selmon = m;
+			focus(NULL);
+		}
+
+		if (!c->isfloating)
+			togglefloating(NULL);
+		animateclient(c, x, y, width - (c->bw * 2), height - (c->bw * 2), 10, 0);
+		arrange(selmon);
+	}
+}
+
+/* let the user drag out a rectangle on the root window; a click without
+ * dragging picks the window under the pointer and Escape cancels.
+ * returns 1 if a region was selected */
+int
+selectregion(int *rx, int *ry, int *rw, int *rh)
+{
+	int i, x, y, sx, sy, pressed = 0, moved = 0, ret = 0;
+	int bw = borderpx;
+	Window edges[4];
+	XEvent ev;
+	Client *c;
+	Time lasttime = 0;
+	XSetWindowAttributes wa = {
+		.override_redirect = True,
+		.background_pixel = scheme[SchemeSel][ColFloat].pixel,
+	};
+
+	if (XGrabPointer(dpy, root, False, MOUSEMASK, GrabModeAsync, GrabModeAsync,
+		None, cursor[CurResize]->cursor, CurrentTime) != GrabSuccess)
+		return 0;
+	if (XGrabKeyboard(dpy, root, True, GrabModeAsync, GrabModeAsync, CurrentTime) != GrabSuccess) {
+		XUngrabPointer(dpy, CurrentTime);
+		return 0;
+	}
+	for (i = 0; i < 4; i++)
+		edges[i] = XCreateWindow(dpy, root, 0, 0, 1, 1, 0, DefaultDepth(dpy, screen),
+				CopyFromParent, DefaultVisual(dpy, screen),
+				CWOverrideRedirect|CWBackPixel, &wa);
+	sx = sy = x = y = 0;
+
+	/* a button still held from the binding that started the selection is
+	 * ignored until it is released and pressed again */
 	do {
-		XMaskEvent(dpy, MOUSEMASK|ExposureMask|SubstructureRedirectMask, &ev);
+		XMaskEvent(dpy, MOUSEMASK|KeyPressMask|ExposureMask|SubstructureRedirectMask, &ev);
 		switch(ev.type) {
 		case ConfigureRequest:
 		case Expose:
 		case MapRequest:
 			handler[ev.type](&ev);
 			break;
+		case KeyPress:
+			if (XLookupKeysym(&ev.xkey, 0) == XK_Escape)
+				goto done;
+			break;
+		case ButtonPress:
+			if (pressed)
+				break;
+			pressed = 1;
+			sx = x = ev.xbutton.x_root;
+			sy = y = ev.xbutton.y_root;
+			break;
+		case MotionNotify:
+			if (!pressed || (ev.xmotion.time - lasttime) <= (1000 / 60))
+				continue;
+			lasttime = ev.xmotion.time;
+			x = ev.xmotion.x_root;
+			y = ev.xmotion.y_root;
+			if (!moved && abs(x - sx) < 5 && abs(y - sy) < 5)
+				break;
+			if (!moved)
+				for (i = 0; i < 4; i++)
+					XMapRaised(dpy, edges[i]);
+			moved = 1;
+			*rx = MIN(sx, x);
+			*ry = MIN(sy, y);
+			*rw = MAX(abs(x - sx), 2 * bw);
+			*rh = MAX(abs(y - sy), 2 * bw);
+			XMoveResizeWindow(dpy, edges[0], *rx, *ry, *rw, bw);
+			XMoveResizeWindow(dpy, edges[1], *rx, *ry + *rh - bw, *rw, bw);
+			XMoveResizeWindow(dpy, edges[2], *rx, *ry, bw, *rh);
+			XMoveResizeWindow(dpy, edges[3], *rx + *rw - bw, *ry, bw, *rh);
+			break;
 		}
-	} while (ev.type != ButtonRelease);
+	} while (ev.type != ButtonRelease || !pressed);
+
+	if (moved) {
+		*rx = MIN(sx, ev.xbutton.x_root);
+		*ry = MIN(sy, ev.xbutton.y_root);
+		*rw = abs(ev.xbutton.x_root - sx);
+		*rh = abs(ev.xbutton.y_root - sy);
+		ret = 1;
+	} else if ((c = wintoclient(ev.xbutton.subwindow))) {
+		*rx = c->x;
+		*ry = c->y;
+		*rw = WIDTH(c);
+		*rh = HEIGHT(c);
+		ret = 1;
+	}
+done:
+	for (i = 0; i < 4; i++)
+		XDestroyWindow(dpy, edges[i]);
+	XUngrabKeyboard(dpy, CurrentTime);
 	XUngrabPointer(dpy, CurrentTime);
-
+	return ret;
 }
 
-
-void drawwindow(const Arg *arg) {
-
-    char str[100];
-    int i;
-    char strout[100];
-	int dimensions[4];
-    int width, height, x, y;
-    char tmpstring[30] = {};
-	int firstchar = 0;
-    int counter = 0;
-    int exitcode;
-	Monitor *m;
+/* saves the focused client, the selected monitor or a selected region
+ * as a png. Capturing is a single round trip, encoding happens on a
+ * thread of its own */
+void
+screenshot(const Arg *arg)
+{
+#ifdef SCREENSHOT
+	int x, y, w, h, ok = 0;
+	char stamp[32], *home;
+	struct timespec ts;
+	XImage *img = NULL;
+	pthread_t t;
 	Client *c;
-
-	if (!selmon->sel)
-		return;
-	FILE *fp = popen("instantslop", "r");
-
-    while (fgets(str, 100, fp) != NULL) {
-    	strcat(strout, str);
-    }
-
-	pclose(fp);
-
-	if (strlen(strout) < 6) {
-		return;
+	Shot *s;
+#ifdef XSHM
+	XShmSegmentInfo info;
+#endif /* XSHM */
+
+	switch (arg->i) {
+	case ShotClient:
+		if (!(c = selmon->sel))
+			return;
+		x = c->x + c->bw;
+		y = c->y + c->bw;
+		w = c->w;
+		h = c->h;
+		break;
+	case ShotRegion:
+		if (!selectregion(&x, &y, &w, &h))
+			return;
+		/* let the windows under the selection edges repaint */
+		XSync(dpy, False);
+		clockstart(selmon);
+		waitframe(selmon);
+		waitframe(selmon);
+		break;
+	default:
+		x = selmon->mx;
+		y = selmon->my;
+		w = selmon->mw;
+		h = selmon->mh;
+		break;
 	}
+	w = MIN(x + w, sw) - MAX(x, 0);
+	h = MIN(y + h, sh) - MAX(y, 0);
+	x = MAX(x, 0);
+	y = MAX(y, 0);
+	if (w <= 0 || h <= 0)
+		return;
 
-
-	for (i = 0; i < strlen(strout); i++){
-		if(!firstchar) {
-			if (strout[i] == 'x') {
-			firstchar = 1;
+	s = ecalloc(1, sizeof(Shot));
+#ifdef XSHM
+	if (XShmQueryExtension(dpy)
+	&& (img = XShmCreateImage(dpy, DefaultVisual(dpy, screen), DefaultDepth(dpy, screen),
+		ZPixmap, NULL, &info, w, h))) {
+		info.readOnly = False;
+		info.shmaddr = (char *)-1;
+		if ((info.shmid = shmget(IPC_PRIVATE, img->bytes_per_line * h, IPC_CREAT | 0600)) >= 0
+		&& (info.shmaddr = shmat(info.shmid, NULL, 0)) != (char *)-1) {
+			img->data = info.shmaddr;
+			XSetErrorHandler(xerrordummy);
+			if (XShmAttach(dpy, &info)) {
+				ok = XShmGetImage(dpy, root, img, x, y, AllPlanes);
+				XShmDetach(dpy, &info);
 			}
-			continue;
+			XSync(dpy, False);
+			XSetErrorHandler(xerror);
 		}
-
-		if (strout[i] != 'x') {
-			tmpstring[strlen(tmpstring)] = strout[i];
-		} else {
-			dimensions[counter] = atoi(tmpstring);
-			counter++;
-			memset(tmpstring,0,strlen(tmpstring));
+		if (info.shmid >= 0)
+			shmctl(info.shmid, IPC_RMID, NULL);
+		if (ok) {
+			s->data = (unsigned char *)info.shmaddr;
+			s->shm = 1;
+		} else if (info.shmaddr != (char *)-1) {
+			shmdt(info.shmaddr);
+		}
+		if (!ok) {
+			img->data = NULL;
+			XDestroyImage(img);
+			img = NULL;
 		}
 	}
-
-	x = dimensions[0];
-	y = dimensions[1];
-	width = dimensions[2];
-	height = dimensions[3];
-
-	if (!selmon->sel)
+#endif /* XSHM */
+	if (!img && (img = XGetImage(dpy, root, x, y, w, h, AllPlanes, ZPixmap)))
+		s->data = (unsigned char *)img->data;
+	if (img) {
+		s->w = w;
+		s->h = h;
+		s->stride = img->bytes_per_line;
+		ok = img->bits_per_pixel == 32 && img->byte_order == LSBFirst
+			&& img->red_mask == 0xff0000 && img->blue_mask == 0xff;
+		img->data = NULL; /* s owns the pixels now */
+		XDestroyImage(img);
+	}
+	if (ok) {
+		home = getenv("HOME");
+		clock_gettime(CLOCK_REALTIME, &ts);
+		strftime(stamp, sizeof stamp, "%Y-%m-%d-%H%M%S", localtime(&ts.tv_sec));
+		snprintf(s->path, sizeof s->path, "%s%s%s/%s-%03ld.png",
+			shotdir[0] == '/' ? "" : home ? home : ".", shotdir[0] == '/' ? "" : "/",
+			shotdir, stamp, ts.tv_nsec / 1000000);
+		if (pthread_create(&t, NULL, shotencode, s))
+			shotencode(s);
+		else
+			pthread_detach(t);
 		return;
+	}
+	s->h = 0; /* only releases the pixels */
+	shotencode(s);
+#endif /* SCREENSHOT */
+	/* no capture of our own, leave it to the scripts */
+	spawn(&((Arg) { .v = arg->i == ShotMonitor ? fscrotcmd
+		: arg->i == ShotClient ? wscrotcmd : scrotcmd }));
+}
 
-	c = selmon->sel;
+#ifdef SCREENSHOT
+void
+putbe32(unsigned char *b, uint32_t v)
+{
+	b[0] = v >> 24;
+	b[1] = v >> 16;
+	b[2] = v >> 8;
+	b[3] = v;
+}
 
-	if (width > 50 && height > 50 && x > -40 && y > -40 && width < selmon->mw + 40 && height < selmon->mh + 40 && 
-	(abs(c->w - width) > 20 || abs(c->h - height) > 20 || abs(c->x - x) > 20 || abs(c->y - y) > 20)) {
-		if ((m = recttomon(x, y, width, height)) != selmon) {
-			sendmon(c, m);
-			selmon = m;
-			focus(NULL);
+int
+shotchunk(FILE *f, const char *type, const unsigned char *data, size_t len)
+{
+	unsigned char b[4];
+	uLong crc;
+
+	crc = crc32(0, (const Bytef *)type, 4);
+	if (len)
+		crc = crc32(crc, data, len);
+	putbe32(b, len);
+	fwrite(b, 1, 4, f);
+	fwrite(type, 1, 4, f);
+	fwrite(data, 1, len, f);
+	putbe32(b, crc);
+	fwrite(b, 1, 4, f);
+	return !ferror(f);
+}
+
+/* writes s as an rgb png a row at a time, then releases it. Runs on a
+ * thread of its own and touches neither the display nor any client */
+void *
+shotencode(void *arg)
+{
+	Shot *s = arg;
+	unsigned char ihdr[13] = { 0 }, *row = NULL, *buf = NULL;
+	char tmp[PATH_MAX + 8], *slash;
+	size_t chunk = 1 << 16, n = (size_t)s->w * 3 + 1;
+	z_stream z = { 0 };
+	FILE *f = NULL;
+	int y, r = Z_OK, flush, ok = 0;
+
+	if (!s->h)
+		goto done;
+	snprintf(tmp, sizeof tmp, "%s.part", s->path);
+	if ((slash = strrchr(tmp, '/'))) {
+		*slash = '\0';
+		mkdir(tmp, 0755);
+		*slash = '/';
+	}
+	/* shotrow() stores 16 bytes for every 12 */
+	row = ecalloc(1, n + 16);
+	buf = ecalloc(1, chunk);
+	if (!(f = fopen(tmp, "wb")) || deflateInit(&z, Z_BEST_SPEED) != Z_OK)
+		goto done;
+
+	fwrite("\x89PNG\r\n\x1a\n", 1, 8, f);
+	putbe32(ihdr, s->w);
+	putbe32(ihdr + 4, s->h);
+	ihdr[8] = 8; /* bits per sample */
+	ihdr[9] = 2; /* truecolour */
+	if (!shotchunk(f, "IHDR", ihdr, sizeof ihdr))
+		goto end;
+	z.next_out = buf;
+	z.avail_out = chunk;
+	for (y = 0; y <= s->h; y++) {
+		if (y < s->h) {
+			row[0] = 0; /* no filter */
+			shotrow(row + 1, s->data + (size_t)y * s->stride, s->w);
+			z.next_in = row;
+			z.avail_in = n;
 		}
-
-		if (!c->isfloating)
-			togglefloating(NULL);
-		animateclient(c, x, y, width - (c->bw * 2), height - (c->bw * 2), 10, 0);
-		arrange(selmon);
-	} else {
-		fprintf(stderr, "errror %s", strout);
+		flush = y < s->h ? Z_NO_FLUSH : Z_FINISH;
+		do {
+			if ((r = deflate(&z, flush)) == Z_STREAM_ERROR)
+				goto end;
+			if (!z.avail_out || r == Z_STREAM_END) {
+				if (!shotchunk(f, "IDAT", buf, chunk - z.avail_out))
+					goto end;
+				z.next_out = buf;
+				z.avail_out = chunk;
+			}
+		} while (z.avail_in || (flush == Z_FINISH && r != Z_STREAM_END));
 	}
-	memset(tmpstring,0,strlen(tmpstring));
-
-	counter = 0;
+	ok = shotchunk(f, "IEND", buf, 0);
+end:
+	deflateEnd(&z);
+done:
+	if (f && fclose(f) == 0 && ok)
+		ok = rename(tmp, s->path) == 0;
+	if (s->h && !ok) {
+		fprintf(stderr, "instantwm: screenshot: cannot write %s\n", s->path);
+		if (f)
+			unlink(tmp);
+	}
+#ifdef XSHM
+	if (s->shm)
+		shmdt(s->data);
+	else
+#endif /* XSHM */
+		free(s->data);
+	free(row);
+	free(buf);
+	free(s);
+	return NULL;
 }
 
+/* BGRX to packed RGB, dst needs 16 bytes of room past 3 * n */
+void
+shotrow(unsigned char *dst, const unsigned char *src, int n)
+{
+#ifdef __SSE2__
+	const __m128i lo = _mm_set1_epi32(0xff), mid = _mm_set1_epi32(0xff00);
+	const __m128i pix0 = _mm_set1_epi64x(0xffffff), pix1 = _mm_set1_epi64x(0xffffff000000);
+	const __m128i half0 = _mm_setr_epi32(-1, 0xffff, 0, 0), half1 = _mm_setr_epi32(0, 0xffff0000, -1, 0);
+	__m128i v;
+
+	/* four pixels at a time: swap red and blue within each lane, close
+	 * the gap after every second pixel, then after the sixth byte */
+	for (; n >= 4; n -= 4, src += 16, dst += 12) {
+		v = _mm_loadu_si128((const __m128i *)src);
+		v = _mm_or_si128(_mm_or_si128(_mm_and_si128(_mm_srli_epi32(v, 16), lo),
+			_mm_and_si128(v, mid)), _mm_slli_epi32(_mm_and_si128(v, lo), 16));
+		v = _mm_or_si128(_mm_and_si128(v, pix0), _mm_and_si128(_mm_srli_epi64(v, 8), pix1));
+		v = _mm_or_si128(_mm_and_si128(v, half0), _mm_and_si128(_mm_srli_si128(v, 2), half1));
+		_mm_storeu_si128((__m128i *)dst, v);
+	}
+#endif /* __SSE2__ */
+	for (; n > 0; n--, src += 4, dst += 3) {
+		dst[0] = src[2];
+		dst[1] = src[1];
+		dst[2] = src[0];
+	}
+}
+#endif /* SCREENSHOT */
 
 void
 dragtag(const Arg *arg)
 {
 	if (!tagwidth)
 		tagwidth = gettagwidth();
-	if ((arg->ui & TAGMASK) != selmon->tagset[selmon->seltags]) {
+	if (!tsequal(tsand(arg->t, tagmask), selmon->tagset[selmon->seltags])) {
 		view(arg);
 		return;
 	}
@@ -2692,9 +4391,9 @@ dragtag(const Arg *arg)
 	if (!leftbar) {
 		if (ev.xmotion.x_root < selmon->mx + tagwidth) {
 			if (ev.xmotion.state & ShiftMask)
-				followtag(&((Arg) { .ui = 1 << getxtag(ev.xmotion.x_root) }));
+				followtag(&((Arg) { .t = tagbit(getxtag(ev.xmotion.x_root)) }));
 			else
-				tag(&((Arg) { .ui = 1 << getxtag(ev.xmotion.x_root) }));
+				tag(&((Arg) { .t = tagbit(getxtag(ev.xmotion.x_root)) }));
 		} else if (ev.xmotion.x_root > selmon->mx + selmon->mw - 50) {
 			if (selmon->sel == selmon->overlay) {
 				setoverlay();
@@ -2719,6 +4418,199 @@ nexttiled(Client *c)
 	return c;
 }
 
+/* Find a spot for a new floating client. Transients are centred on their
+ * parent. Anything else goes where it overlaps the fewest visible floating
+ * windows, and among those spots the one closest to where it asked to be.
+ *
+ * c at x, y overlaps window t iff x lies in the open interval
+ * (t->x - WIDTH(c), t->x + WIDTH(t)) and y in the matching one. Overlap
+ * counts only change at the ends of these intervals, so those are the only
+ * candidate positions. Rows are swept top down, adding and removing each
+ * window's columns in a segment tree of counts, which then yields the
+ * lowest count of a row and its position closest to the preferred column.
+ * That is O(n log n) for n floating windows */
+void
+place(Client *c, Client *p)
+{
+	Monitor *m = c->mon;
+	Client *t;
+	Span *sp, *end;
+	int *xs, *ys, *mn, *ad;
+	int i, j, k, s, e, l, r, n = 0, nx = 0, ny = 0, pxi, d;
+	int best = INT_MAX, bd = INT_MAX, bx = 0, by = 0;
+	int cw = WIDTH(c), ch = HEIGHT(c);
+	int xlo = m->wx, xhi = m->wx + m->ww - cw;
+	int ylo = m->wy, yhi = m->wy + m->wh - ch;
+	int px = MAX(xlo, MIN(c->x, xhi)), py = MAX(ylo, MIN(c->y, yhi));
+
+	/* too large to be placed, keep it where manage() clamped it */
+	if (xhi < xlo || yhi < ylo)
+		return;
+	if (p && p->mon == m) {
+		c->x = MAX(xlo, MIN(p->x + (WIDTH(p) - cw) / 2, xhi));
+		c->y = MAX(ylo, MIN(p->y + (HEIGHT(p) - ch) / 2, yhi));
+		return;
+	}
+
+	for (t = m->clients; t; t = t->next)
+		if (ISVISIBLE(t) && !t->isfullscreen && (t->isfloating || !m->lt[m->sellt]->arrange))
+			n++;
+	c->x = px;
+	c->y = py;
+	if (!n)
+		return;
+	sp = ecalloc(n, sizeof(Span));
+	end = ecalloc(n, sizeof(Span));
+	xs = ecalloc(2 * n + 3, sizeof(int));
+	ys = ecalloc(2 * n + 3, sizeof(int));
+	xs[nx++] = xlo;
+	xs[nx++] = xhi;
+	xs[nx++] = px;
+	ys[ny++] = ylo;
+	ys[ny++] = yhi;
+	ys[ny++] = py;
+	for (i = 0, t = m->clients; t; t = t->next) {
+		if (!ISVISIBLE(t) || t->isfullscreen || !(t->isfloating || !m->lt[m->sellt]->arrange))
+			continue;
+		sp[i].x0 = t->x - cw;
+		sp[i].x1 = t->x + WIDTH(t);
+		sp[i].y0 = t->y - ch;
+		sp[i].y1 = t->y + HEIGHT(t);
+		if (sp[i].x0 > xlo && sp[i].x0 < xhi)
+			xs[nx++] = sp[i].x0;
+		if (sp[i].x1 > xlo && sp[i].x1 < xhi)
+			xs[nx++] = sp[i].x1;
+		if (sp[i].y0 > ylo && sp[i].y0 < yhi)
+			ys[ny++] = sp[i].y0;
+		if (sp[i].y1 > ylo && sp[i].y1 < yhi)
+			ys[ny++] = sp[i].y1;
+		i++;
+	}
+	qsort(xs, nx, sizeof(int), placecmp);
+	qsort(ys, ny, sizeof(int), placecmp);
+	for (i = j = 1; i < nx; i++)
+		if (xs[i] != xs[j - 1])
+			xs[j++] = xs[i];
+	nx = j;
+	for (i = j = 1; i < ny; i++)
+		if (ys[i] != ys[j - 1])
+			ys[j++] = ys[i];
+	ny = j;
+	memcpy(end, sp, n * sizeof(Span));
+	qsort(sp, n, sizeof(Span), placecmpy0);
+	qsort(end, n, sizeof(Span), placecmpy1);
+	mn = ecalloc(4 * nx, sizeof(int));
+	ad = ecalloc(4 * nx, sizeof(int));
+	pxi = placebound(xs, nx, px);
+
+	for (j = s = e = 0; j < ny; j++) {
+		if (!best && ys[j] - py > bd)
+			break; /* nothing closer can follow */
+		/* windows whose interval holds ys[j] */
+		for (; s < n && sp[s].y0 < ys[j]; s++)
+			if ((l = placebound(xs, nx, sp[s].x0 + 1)) <= (r = placebound(xs, nx, sp[s].x1) - 1))
+				placeadd(mn, ad, 1, 0, nx - 1, l, r, 1);
+		for (; e < n && end[e].y1 <= ys[j]; e++)
+			if ((l = placebound(xs, nx, end[e].x0 + 1)) <= (r = placebound(xs, nx, end[e].x1) - 1))
+				placeadd(mn, ad, 1, 0, nx - 1, l, r, -1);
+		if (mn[1] > best)
+			continue;
+		/* nearest lowest count left and right of the preferred column */
+		for (i = 0; i < 2; i++) {
+			k = i ? placefind(mn, ad, 1, 0, nx - 1, pxi, nx - 1, mn[1], 0, 0)
+			      : placefind(mn, ad, 1, 0, nx - 1, 0, pxi, mn[1], 0, 1);
+			if (k < 0)
+				continue;
+			d = abs(xs[k] - px) + abs(ys[j] - py);
+			if (mn[1] < best || d < bd) {
+				best = mn[1];
+				bd = d;
+				bx = xs[k];
+				by = ys[j];
+			}
+		}
+	}
+	c->x = bx;
+	c->y = by;
+	free(sp);
+	free(end);
+	free(xs);
+	free(ys);
+	free(mn);
+	free(ad);
+}
+
+/* add v to [ql, qr] below node n, which covers [l, r]. mn[n] is the lowest
+ * count below n, counting adds at n but not those of its ancestors */
+void
+placeadd(int *mn, int *ad, int n, int l, int r, int ql, int qr, int v)
+{
+	if (qr < l || r < ql)
+		return;
+	if (ql <= l && r <= qr) {
+		ad[n] += v;
+		mn[n] += v;
+		return;
+	}
+	placeadd(mn, ad, 2 * n, l, (l + r) / 2, ql, qr, v);
+	placeadd(mn, ad, 2 * n + 1, (l + r) / 2 + 1, r, ql, qr, v);
+	mn[n] = ad[n] + MIN(mn[2 * n], mn[2 * n + 1]);
+}
+
+/* first index in the sorted a[n] not below v */
+int
+placebound(const int *a, int n, int v)
+{
+	int l = 0, r = n, mid;
+
+	while (l < r) {
+		mid = (l + r) / 2;
+		if (a[mid] < v)
+			l = mid + 1;
+		else
+			r = mid;
+	}
+	return l;
+}
+
+int
+placecmp(const void *a, const void *b)
+{
+	return (*(const int *)a > *(const int *)b) - (*(const int *)a < *(const int *)b);
+}
+
+int
+placecmpy0(const void *a, const void *b)
+{
+	return placecmp(&((const Span *)a)->y0, &((const Span *)b)->y0);
+}
+
+int
+placecmpy1(const void *a, const void *b)
+{
+	return placecmp(&((const Span *)a)->y1, &((const Span *)b)->y1);
+}
+
+/* first, or with last the last, index in [ql, qr] whose count is target.
+ * acc is the sum of adds above n */
+int
+placefind(const int *mn, const int *ad, int n, int l, int r, int ql, int qr, int target, int acc, int last)
+{
+	int i;
+
+	if (qr < l || r < ql || mn[n] + acc > target)
+		return -1;
+	if (l == r)
+		return l;
+	acc += ad[n];
+	if (last) {
+		if ((i = placefind(mn, ad, 2 * n + 1, (l + r) / 2 + 1, r, ql, qr, target, acc, last)) < 0)
+			i = placefind(mn, ad, 2 * n, l, (l + r) / 2, ql, qr, target, acc, last);
+	} else if ((i = placefind(mn, ad, 2 * n, l, (l + r) / 2, ql, qr, target, acc, last)) < 0)
+		i = placefind(mn, ad, 2 * n + 1, (l + r) / 2 + 1, r, ql, qr, target, acc, last);
+	return i;
+}
+
 void
 pop(Client *c)
 {
@@ -2742,8 +4634,8 @@ propertynotify(XEvent *e)
 		}
 		else
 			updatesystrayiconstate(c, ev);
-		resizebarwin(selmon);
 		updatesystray();
+		resizebarwin(selmon);
 	}
 	if ((ev->window == root) && (ev->atom == XA_WM_NAME))
 		updatestatus();
@@ -2765,13 +4657,20 @@ propertynotify(XEvent *e)
 			drawbars();
 			break;
 		}
-		if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) {
+		if ((ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) && c->mon->gamemode) {
+			c->mon->deferred = 1;
+		} else if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) {
 			updatetitle(c);
 			if (c == c->mon->sel)
-				drawbar(c->mon);
+				deferbar(c->mon);
 		}
 		if (ev->atom == netatom[NetWMWindowType])
 			updatewindowtype(c);
+		if (ev->atom == netatom[NetWMIcon]) {
+			c->iconstale = 1;
+			idlequeue(IdleIcons);
+			deferbar(c->mon);
+		}
 		if (ev->atom == motifatom)
 			updatemotifhints(c);
 
@@ -2784,6 +4683,297 @@ quit(const Arg *arg)
 	running = 0;
 }
 
+/* replace the running binary with the one at wmpath, keeping the layout */
+void
+restart(const Arg *arg)
+{
+	const char *dir = getenv("XDG_RUNTIME_DIR");
+
+	/* see execrestart(), keep running rather than quit the session */
+	if (!dir || !*dir) {
+		fputs("instantwm: XDG_RUNTIME_DIR is not set, not restarting\n", stderr);
+		return;
+	}
+	restarting = 1;
+	running = 0;
+}
+
+int
+layoutindex(const Layout *l)
+{
+	int i;
+
+	for (i = 0; i < LENGTH(layouts); i++)
+		if (l == &layouts[i])
+			return i;
+	return 0;
+}
+
+/* snapshot monitors, per tag settings and clients into a memory mapped
+ * file for the next instance */
+int
+writestate(char *path)
+{
+	StateHeader *h;
+	MonitorState *ms;
+	ClientState *cs;
+	Monitor *m;
+	Client *c;
+	size_t size;
+	int fd, i, n, nmons = 0, nclients = 0;
+
+	for (m = mons; m; m = m->next, nmons++)
+		for (c = m->clients; c; c = c->next)
+			nclients++;
+	size = sizeof(StateHeader) + nmons * sizeof(MonitorState) + nclients * sizeof(ClientState);
+	/* path ends in XXXXXX, mkstemp() fills it in and never follows or
+	 * reuses an existing file */
+	if ((fd = mkstemp(path)) < 0)
+		return 0;
+	if (ftruncate(fd, size) < 0
+	|| (h = mmap(NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		unlink(path);
+		return 0;
+	}
+	close(fd);
+	memcpy(h->magic, "instwm", 7);
+	h->version = STATEVERSION;
+	h->ntags = LENGTH(tags);
+	h->nmons = nmons;
+	h->nclients = nclients;
+	h->selmon = selmon->num;
+	h->sel = selmon->sel ? selmon->sel->win : None;
+	ms = (MonitorState *)(h + 1);
+	cs = (ClientState *)(ms + nmons);
+	for (m = mons; m; m = m->next, ms++) {
+		ms->num = m->num;
+		ms->mx = m->mx;
+		ms->my = m->my;
+		ms->mw = m->mw;
+		ms->mh = m->mh;
+		ms->mfact = m->mfact;
+		ms->nmaster = m->nmaster;
+		ms->seltags = m->seltags;
+		ms->sellt = m->sellt;
+		ms->tagset[0] = m->tagset[0];
+		ms->tagset[1] = m->tagset[1];
+		ms->lt[0] = layoutindex(m->lt[0]);
+		ms->lt[1] = layoutindex(m->lt[1]);
+		ms->showbar = m->showbar;
+		ms->showtags = m->showtags;
+		ms->overlaystatus = m->overlaystatus;
+		ms->overlay = m->overlay ? m->overlay->win : None;
+		ms->curtag = m->pertag->curtag;
+		ms->prevtag = m->pertag->prevtag;
+		for (i = 0; i <= LENGTH(tags); i++) {
+			ms->nmasters[i] = m->pertag->nmasters[i];
+			ms->mfacts[i] = m->pertag->mfacts[i];
+			ms->sellts[i] = m->pertag->sellts[i];
+			ms->ltidxs[i][0] = layoutindex(m->pertag->ltidxs[i][0]);
+			ms->ltidxs[i][1] = layoutindex(m->pertag->ltidxs[i][1]);
+			ms->showbars[i] = m->pertag->showbars[i];
+		}
+		for (c = m->clients; c; c = c->next, cs++) {
+			Client *s;
+
+			for (n = 0, s = m->stack; s && s != c; s = s->snext, n++);
+			cs->win = c->win;
+			cs->mon = m->num;
+			cs->stackpos = n;
+			cs->tags = c->tags;
+			cs->x = c->x;
+			cs->y = c->y;
+			cs->w = c->w;
+			cs->h = c->h;
+			cs->sfx = c->sfx;
+			cs->sfy = c->sfy;
+			cs->sfw = c->sfw;
+			cs->sfh = c->sfh;
+			cs->oldx = c->oldx;
+			cs->oldy = c->oldy;
+			cs->oldw = c->oldw;
+			cs->oldh = c->oldh;
+			cs->bw = c->bw;
+			cs->oldbw = c->oldbw;
+			cs->isfloating = c->isfloating;
+			cs->oldstate = c->oldstate;
+			cs->isfullscreen = c->isfullscreen;
+			cs->isfakefullscreen = c->isfakefullscreen;
+			cs->islocked = c->islocked;
+			cs->issticky = c->issticky;
+			cs->freeze = c->freeze;
+			cs->pgid = c->pgid;
+			cs->orignice = c->orignice;
+		}
+	}
+	msync(h, size, MS_SYNC);
+	munmap(h, size);
+	return 1;
+}
+
+/* called after run() returned: hand the session over to a fresh copy
+ * of ourselves without unmanaging anything */
+void
+execrestart(void)
+{
+	char path[PATH_MAX], *dir, *argv[4];
+	Monitor *m;
+	Client *c;
+
+	/* the state decides which process groups get stopped and reniced,
+	 * so it only goes where other users cannot reach it */
+	if (!(dir = getenv("XDG_RUNTIME_DIR")) || !*dir)
+		return;
+	snprintf(path, sizeof path, "%s/instantwm-%d.XXXXXX", dir, (int)getpid());
+	/* the new instance knows nothing about stopped groups or niceness */
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next) {
+			thaw(c);
+			if (c->pgid && c->nice != c->orignice)
+				setnice(c, c->orignice);
+		}
+	if (!writestate(path))
+		return;
+	/* tray icons get reparented to root when we go away; keep them
+	 * unmapped so scan() does not adopt them, they dock again as soon
+	 * as the new tray announces itself */
+	if (systray)
+		for (c = systray->icons; c; c = c->next) {
+			XUnmapWindow(dpy, c->win);
+			XReparentWindow(dpy, c->win, root, 0, 0);
+			XRemoveFromSaveSet(dpy, c->win);
+		}
+	XSync(dpy, False);
+	argv[0] = wmpath;
+	argv[1] = "-r";
+	argv[2] = path;
+	argv[3] = NULL;
+	execvp(wmpath, argv);
+	fprintf(stderr, "instantwm: execvp %s failed:", wmpath);
+	perror(" ");
+	unlink(path);
+}
+
+void
+readstate(const char *path)
+{
+	struct stat st;
+	StateHeader *h;
+	int fd;
+
+	if ((fd = open(path, O_RDONLY|O_CLOEXEC|O_NOFOLLOW)) < 0)
+		return;
+	/* only trust a file we wrote ourselves */
+	if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode) || st.st_uid != getuid()) {
+		fprintf(stderr, "instantwm: ignoring foreign state file %s\n", path);
+		close(fd);
+		return;
+	}
+	if ((size_t)st.st_size < sizeof(StateHeader)
+	|| (h = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0)) == MAP_FAILED) {
+		close(fd);
+		unlink(path);
+		return;
+	}
+	close(fd);
+	unlink(path);
+	if (memcmp(h->magic, "instwm", 7) || h->version != STATEVERSION
+	|| h->ntags != LENGTH(tags) || h->nmons < 0 || h->nclients < 0
+	|| (size_t)st.st_size != sizeof(StateHeader) + h->nmons * sizeof(MonitorState)
+		+ h->nclients * sizeof(ClientState)) {
+		fprintf(stderr, "instantwm: ignoring stale state file %s\n", path);
+		munmap(h, st.st_size);
+		return;
+	}
+	state = h;
+	statesize = st.st_size;
+}
+
+ClientState *
+findstate(Window w)
+{
+	ClientState *cs;
+	int i;
+
+	if (!state)
+		return NULL;
+	cs = (ClientState *)((MonitorState *)(state + 1) + state->nmons);
+	for (i = 0; i < state->nclients; i++)
+		if (cs[i].win == w)
+			return &cs[i];
+	return NULL;
+}
+
+/* after scan(): bring back per monitor settings and the client order */
+void
+restorestate(void)
+{
+	MonitorState *ms = (MonitorState *)(state + 1);
+	ClientState *cs = (ClientState *)(ms + state->nmons);
+	Client *c;
+	Monitor *m;
+	int i, j, n;
+
+	for (m = mons; m; m = m->next) {
+		for (i = 0; i < state->nmons && ms[i].num != m->num; i++);
+		if (i == state->nmons)
+			continue;
+		m->mfact = ms[i].mfact;
+		m->nmaster = ms[i].nmaster;
+		m->seltags = ms[i].seltags & 1;
+		m->sellt = ms[i].sellt & 1;
+		m->tagset[0] = tsany(tsand(ms[i].tagset[0], tagmask)) ? tsand(ms[i].tagset[0], tagmask) : tagbit(0);
+		m->tagset[1] = tsany(tsand(ms[i].tagset[1], tagmask)) ? tsand(ms[i].tagset[1], tagmask) : tagbit(0);
+		m->lt[0] = &layouts[ms[i].lt[0] % LENGTH(layouts)];
+		m->lt[1] = &layouts[ms[i].lt[1] % LENGTH(layouts)];
+		strncpy(m->ltsymbol, m->lt[m->sellt]->symbol, sizeof m->ltsymbol);
+		m->ltsymbol[sizeof m->ltsymbol - 1] = '\0';
+		m->showbar = ms[i].showbar;
+		m->showtags = ms[i].showtags;
+		m->pertag->curtag = ms[i].curtag % (LENGTH(tags) + 1);
+		m->pertag->prevtag = ms[i].prevtag % (LENGTH(tags) + 1);
+		for (j = 0; j <= LENGTH(tags); j++) {
+			m->pertag->nmasters[j] = ms[i].nmasters[j];
+			m->pertag->mfacts[j] = ms[i].mfacts[j];
+			m->pertag->sellts[j] = ms[i].sellts[j] & 1;
+			m->pertag->ltidxs[j][0] = &layouts[ms[i].ltidxs[j][0] % LENGTH(layouts)];
+			m->pertag->ltidxs[j][1] = &layouts[ms[i].ltidxs[j][1] % LENGTH(layouts)];
+			m->pertag->showbars[j] = ms[i].showbars[j];
+		}
+		if ((c = wintoclient(ms[i].overlay)) && c->mon == m) {
+			m->overlay = c;
+			m->overlaystatus = ms[i].overlaystatus;
+		}
+		updatebarpos(m);
+		XMoveResizeWindow(dpy, m->barwin, m->wx, m->by, m->ww, bh);
+		/* manage() attached at the head, replay the snapshot backwards */
+		for (n = state->nclients - 1; n >= 0; n--)
+			if (cs[n].mon == m->num && (c = wintoclient(cs[n].win)) && c->mon == m) {
+				detach(c);
+				attach(c);
+			}
+		for (j = state->nclients - 1; j >= 0; j--)
+			for (n = 0; n < state->nclients; n++)
+				if (cs[n].mon == m->num && cs[n].stackpos == j
+				&& (c = wintoclient(cs[n].win)) && c->mon == m) {
+					detachstack(c);
+					attachstack(c);
+				}
+	}
+	for (m = mons; m && m->num != state->selmon; m = m->next);
+	if (m)
+		selmon = m;
+	if ((c = wintoclient(state->sel)) && c->mon == selmon)
+		selmon->sel = c;
+	else
+		selmon->sel = NULL;
+	munmap(state, statesize);
+	state = NULL;
+	arrange(NULL);
+	focus(selmon->sel);
+}
+
 Monitor *
 recttomon(int x, int y, int w, int h)
 {
@@ -3103,8 +5293,8 @@ resizerequest(XEvent *e)
 
 	if ((i = wintosystrayicon(ev->window))) {
 		updatesystrayicongeom(i, ev->width, ev->height);
-		resizebarwin(selmon);
 		updatesystray();
+		resizebarwin(selmon);
 	}
 }
 
@@ -3133,20 +5323,76 @@ restack(Monitor *m)
 	while (XCheckMaskEvent(dpy, EnterWindowMask, &ev));
 }
 
+void
+reapchildren(void)
+{
+	pid_t pid;
+	int i;
+#ifdef __linux__
+	struct signalfd_siginfo si;
+
+	while (read(sigfd, &si, sizeof si) == sizeof si);
+#else
+	char buf[64];
+
+	while (read(sigfd, buf, sizeof buf) > 0);
+#endif /* __linux__ */
+	while (0 < (pid = waitpid(-1, NULL, WNOHANG)))
+		for (i = 0; i < LENGTH(cmdqueue); i++)
+			if (cmdqueue[i].cmd && cmdqueue[i].pid == pid) {
+				cmdqueue[i].pid = 0;
+				cmdqueuerun(&cmdqueue[i]);
+			}
+}
+
 void
 run(void)
 {
 	XEvent ev;
+	struct pollfd fds[] = {
+		{ .fd = ConnectionNumber(dpy), .events = POLLIN },
+		{ .fd = sigfd, .events = POLLIN },
+	};
+	int timeout, bars, reps;
+
 	/* main event loop */
 	XSync(dpy, False);
-	while (running && !XNextEvent(dpy, &ev))
-		if (handler[ev.type])
-			handler[ev.type](&ev); /* call handler */
+	while (running) {
+		while (running && XPending(dpy)) {
+			XNextEvent(dpy, &ev);
+			dispatch(&ev);
+		}
+		if (geomdirty) {
+			updatemonitors();
+			continue;
+		}
+		if (!running)
+			break;
+		timeout = freezetimeout();
+		if ((bars = bartimeout()) >= 0 && (timeout < 0 || bars < timeout))
+			timeout = bars;
+		if ((reps = repeattimeout()) >= 0 && (timeout < 0 || reps < timeout))
+			timeout = reps;
+		if (idlepending())
+			timeout = 0;
+		if (poll(fds, LENGTH(fds), timeout) < 0 && errno != EINTR)
+			die("poll:");
+		if (fds[1].revents & POLLIN)
+			reapchildren();
+		freezeclients();
+		flushrepeat(0);
+		flushbars();
+		/* nothing came in, spend a slice on deferred work */
+		if (!(fds[0].revents & POLLIN) && !XEventsQueued(dpy, QueuedAlready))
+			idlerun(fds[0].fd);
+	}
 }
 
 void
 runAutostart(void) {
-	system("cd /usr/bin; ./instantautostart &");
+	char *const cmd[] = { "/bin/sh", "-c", "cd /usr/bin; exec ./instantautostart", NULL };
+
+	spawnv(cmd);
 }
 
 void
@@ -3158,14 +5404,16 @@ scan(void)
 
 	if (XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
 		for (i = 0; i < num; i++) {
-			if (!XGetWindowAttributes(dpy, wins[i], &wa)
-			|| wa.override_redirect || XGetTransientForHint(dpy, wins[i], &d1))
+			if (!XGetWindowAttributes(dpy, wins[i], &wa) || wa.override_redirect)
+				continue;
+			/* windows from the snapshot are adopted as they were */
+			if (!findstate(wins[i]) && XGetTransientForHint(dpy, wins[i], &d1))
 				continue;
 			if (wa.map_state == IsViewable || getstate(wins[i]) == IconicState)
 				manage(wins[i], &wa);
 		}
 		for (i = 0; i < num; i++) { /* now the transients */
-			if (!XGetWindowAttributes(dpy, wins[i], &wa))
+			if (findstate(wins[i]) || !XGetWindowAttributes(dpy, wins[i], &wa))
 				continue;
 			if (XGetTransientForHint(dpy, wins[i], &d1)
 			&& (wa.map_state == IsViewable || getstate(wins[i]) == IconicState))
@@ -3174,37 +5422,47 @@ scan(void)
 		if (wins)
 			XFree(wins);
 	}
+	restoring = NULL;
+	if (state)
+		restorestate();
+}
+
+/* tags holding at least one client, clients on every tag don't count */
+Tagset
+occupied(Monitor *m)
+{
+	Tagset occ = {{ 0 }};
+	Client *c;
+
+	for (c = m->clients; c; c = c->next)
+		if (!tsequal(tsand(c->tags, tagmask), tagmask))
+			occ = tsor(occ, c->tags);
+	return occ;
 }
 
 int gettagwidth() {
-	int x, i, occ;
+	int x, i;
+	Tagset occ = tsor(occupied(selmon), selmon->tagset[selmon->seltags]);
 	i = x = 0;
 	do {
 		// do not reserve space for vacant tags
-		if (selmon->showtags){
-			if (!(occ & 1 << i || selmon->tagset[selmon->seltags] & 1 << i))
-				continue;
-		}
-		x += TEXTW(tags[i]);
+		if (selmon->showtags && !tstest(occ, i))
+			continue;
+		x += labelw[i];
 	} while (++i < LENGTH(tags));
 	return x + startmenusize;
 }
 
 int getxtag(int ix) {
-	int x, i, occ;
-	Client *c;
+	int x, i;
+	Tagset occ = tsor(occupied(selmon), selmon->tagset[selmon->seltags]);
 	i = 0;
 	x = startmenusize;
-	for (c = selmon->clients; c; c = c->next)
-		occ |= c->tags == 255 ? 0 : c->tags;
-	
 	do {
 		// do not reserve space for vacant tags
-		if (selmon->showtags){
-			if (!(occ & 1 << i || selmon->tagset[selmon->seltags] & 1 << i))
-				continue;
-		}
-		x += TEXTW(tags[i]);	
+		if (selmon->showtags && !tstest(occ, i))
+			continue;
+		x += labelw[i];	
 	} while (ix >= x + selmon->mx && ++i < LENGTH(tags));
 	return i;
 }
@@ -3297,9 +5555,13 @@ setfullscreen(Client *c, int fullscreen)
 				animateclient(c, c->mon->mx, c->mon->my, c->mon->mw, c->mon->mh, 10, 0);
 			resizeclient(c, c->mon->mx, c->mon->my, c->mon->mw, c->mon->mh);
 			XRaiseWindow(dpy, c->win);
+#ifdef COMPOSITE
+			/* let the server flip to fullscreen clients */
+			setredirect(c, 0);
+#endif /* COMPOSITE */
 		}
 		c->isfloating = 1;
-
+		updategamemode();
 
 	} else if (!fullscreen && c->isfullscreen){
 		XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
@@ -3312,12 +5574,15 @@ setfullscreen(Client *c, int fullscreen)
 		c->y = c->oldy;
 		c->w = c->oldw;
 		c->h = c->oldh;
+#ifdef COMPOSITE
+		setredirect(c, 1);
+#endif /* COMPOSITE */
 
 		if (!c->isfakefullscreen) {
 			resizeclient(c, c->x, c->y, c->w, c->h);
 			arrange(c->mon);
 		}
-
+		updategamemode();
 	}
 }
 
@@ -3354,23 +5619,63 @@ void
 setup(void)
 {
 	int i;
+	Monitor *m;
 	XSetWindowAttributes wa;
 	Atom utf8string;
 
-	/* clean up any zombies immediately */
-	sigchld(0);
+	/* clean up any zombies immediately */
+	setupsigchld();
+
+	for (i = 0; i < LENGTH(tags); i++)
+		tagmask = tsor(tagmask, tagbit(i));
+
+	/* a frozen group must see all its windows, not only the ruled ones */
+	for (i = 0; i < LENGTH(rules); i++)
+		freezerules |= rules[i].freeze;
+
+	/* nice levels are only lowered as far as they can be raised back */
+	if (schedfocus) {
+		struct rlimit rl;
+
+		if (geteuid() == 0)
+			minnice = -20;
+#ifdef RLIMIT_NICE
+		else if (getrlimit(RLIMIT_NICE, &rl) == 0)
+			minnice = rl.rlim_cur == RLIM_INFINITY ? -20 : 20 - (int)MIN(rl.rlim_cur, 40);
+#endif /* RLIMIT_NICE */
+	}
 
 	/* init screen */
 	screen = DefaultScreen(dpy);
 	sw = DisplayWidth(dpy, screen);
 	sh = DisplayHeight(dpy, screen);
 	root = RootWindow(dpy, screen);
-	drw = drw_create(dpy, screen, root, sw, sh);
+	drw = drw_create(dpy, screen, root, sw, 1); /* bar high once bh is known */
 	if (!drw_fontset_create(drw, fonts, LENGTH(fonts)))
 		die("no fonts could be loaded.");
 	lrpad = drw->fonts->h;
 	bh = drw->fonts->h + 12;
+	drw_resize(drw, sw, bh);
+#ifdef RANDR
+	{
+		int err, major = 1, minor = 2;
+
+		randr = XRRQueryExtension(dpy, &randrevent, &err)
+			&& XRRQueryVersion(dpy, &major, &minor) && (major > 1 || minor >= 2);
+		if (randr)
+			XRRSelectInput(dpy, root, RRScreenChangeNotifyMask|RROutputChangeNotifyMask);
+	}
+#endif /* RANDR */
+#ifdef PRESENT
+	{
+		int event, err;
+
+		present = XPresentQueryExtension(dpy, &presentop, &event, &err);
+	}
+#endif /* PRESENT */
 	updategeom();
+	for (m = mons; m; m = m->next)
+		m->changed = 0;
 	/* init atoms */
 	utf8string = XInternAtom(dpy, "UTF8_STRING", False);
 	wmatom[WMProtocols] = XInternAtom(dpy, "WM_PROTOCOLS", False);
@@ -3390,11 +5695,24 @@ setup(void)
 	netatom[NetWMWindowType] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", False);
 	netatom[NetWMWindowTypeDialog] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", False);
 	netatom[NetClientList] = XInternAtom(dpy, "_NET_CLIENT_LIST", False);
+	netatom[NetWMPid] = XInternAtom(dpy, "_NET_WM_PID", False);
+	netatom[NetWMIcon] = XInternAtom(dpy, "_NET_WM_ICON", False);
 	motifatom = XInternAtom(dpy, "_MOTIF_WM_HINTS", False);
 	
 	xatom[Manager] = XInternAtom(dpy, "MANAGER", False);
 	xatom[Xembed] = XInternAtom(dpy, "_XEMBED", False);
 	xatom[XembedInfo] = XInternAtom(dpy, "_XEMBED_INFO", False);
+#ifdef COMPOSITE
+	{
+		int major = 0, minor = 2, ev, err;
+
+		composite = XQueryExtension(dpy, COMPOSITE_NAME, &compositeop, &ev, &err)
+			&& XCompositeQueryVersion(dpy, &major, &minor) && (major > 0 || minor >= 2)
+			&& XQueryExtension(dpy, DAMAGE_NAME, &damageop, &damageevent, &damageerror)
+			&& XRenderQueryExtension(dpy, &ev, &err);
+		rootpmapatom = XInternAtom(dpy, "_XROOTPMAP_ID", False);
+	}
+#endif /* COMPOSITE */
 	/* init cursors */
 	cursor[CurNormal] = drw_cur_create(drw, XC_left_ptr);
 	cursor[CurResize] = drw_cur_create(drw, XC_crosshair);
@@ -3414,6 +5732,11 @@ setup(void)
 
 	for (i = 0; i < LENGTH(colors); i++)
 		scheme[i] = drw_scm_create(drw, colors[i], 4);
+	for (i = 0; i < LENGTH(tags); i++)
+		labelw[i] = TEXTW(tags[i]);
+#ifdef BARTHREAD
+	barstart();
+#endif /* BARTHREAD */
 	/* init system tray */
 	updatesystray();
 	/* init bars */
@@ -3433,11 +5756,11 @@ setup(void)
 	XDeleteProperty(dpy, root, netatom[NetClientList]);
 	/* select events */
 	wa.cursor = cursor[CurNormal]->cursor;
-	wa.event_mask = SubstructureRedirectMask|SubstructureNotifyMask
-		|ButtonPressMask|PointerMotionMask|EnterWindowMask
-		|LeaveWindowMask|StructureNotifyMask|PropertyChangeMask;
+	wa.event_mask = rootmask = ROOTMASK|PointerMotionMask;
 	XChangeWindowAttributes(dpy, root, CWEventMask|CWCursor, &wa);
 	XSelectInput(dpy, root, wa.event_mask);
+	/* held keys repeat as presses only, see keypress() */
+	XkbSetDetectableAutoRepeat(dpy, True, NULL);
 	grabkeys();
 	focus(NULL);
 }
@@ -3459,22 +5782,40 @@ seturgent(Client *c, int urg)
 void
 show(Client *c)
 {
-	int x, y, w, h;
 	if (!c || !HIDDEN(c))
 		return;
+	showclients(&c, 1);
+}
 
-	x = c->x;
-	y = c->y;
-	w = c->w;
-	h = c->h;
+/* shows n hidden clients, sliding them in together and arranging each
+ * monitor once */
+void
+showclients(Client **cs, int n)
+{
+	Monitor *m;
+	int i, *x, *y;
 
-	XMapWindow(dpy, c->win);
-	setclientstate(c, NormalState);
-	resize(c, x, -50 , w, h, 0);
-	XRaiseWindow(dpy, c->win);
-	animateclient(c, x, y, 0, 0, 14, 0);
-	arrange(c->mon);
+	if (!n)
+		return;
+	x = ecalloc(2 * n, sizeof(int));
+	y = x + n;
+	for (i = 0; i < n; i++) {
+		x[i] = cs[i]->x;
+		y[i] = cs[i]->y;
+		XMapWindow(dpy, cs[i]->win);
+		setclientstate(cs[i], NormalState);
+		resize(cs[i], x[i], -50, cs[i]->w, cs[i]->h, 0);
+		XRaiseWindow(dpy, cs[i]->win);
+	}
+	animateclients(cs, x, y, n, 14);
+	free(x);
 
+	for (m = mons; m; m = m->next)
+		for (i = 0; i < n; i++)
+			if (cs[i]->mon == m) {
+				arrange(m);
+				break;
+			}
 }
 
 void
@@ -3484,6 +5825,9 @@ showhide(Client *c)
 		return;
 	if (ISVISIBLE(c)) {
 		/* show clients top down */
+		if (c->frozen)
+			thaw(c);
+		c->hidden.tv_sec = 0;
 		XMoveWindow(dpy, c->win, c->x, c->y);
 		if (!c->mon->lt[c->mon->sellt]->arrange || c->isfloating && (!c->isfullscreen || c->isfakefullscreen))
 			resize(c, c->x, c->y, c->w, c->h, 0);
@@ -3491,16 +5835,70 @@ showhide(Client *c)
 	} else {
 		/* hide clients bottom up */
 		showhide(c->snext);
+		if (c->freeze && !c->hidden.tv_sec)
+			clock_gettime(CLOCK_MONOTONIC, &c->hidden);
 		XMoveWindow(dpy, c->win, WIDTH(c) * -2, c->y);
 	}
 }
 
+#ifndef __linux__
 void
 sigchld(int unused)
 {
-	if (signal(SIGCHLD, sigchld) == SIG_ERR)
-		die("can't install SIGCHLD handler:");
+	int saved = errno;
+
+	write(sigpipe[1], "", 1);
+	errno = saved;
+}
+#endif /* __linux__ */
+
+/* SIGCHLD is not handled asynchronously; it is turned into a readable
+ * descriptor and the children are reaped from run() */
+void
+setupsigchld(void)
+{
+	sigset_t sm;
+	short flags = POSIX_SPAWN_SETSIGMASK | POSIX_SPAWN_SETSIGDEF;
+
+	sigemptyset(&sm);
+	sigaddset(&sm, SIGCHLD);
+#ifdef __linux__
+	if (sigprocmask(SIG_BLOCK, &sm, NULL) < 0
+	|| (sigfd = signalfd(-1, &sm, SFD_NONBLOCK | SFD_CLOEXEC)) < 0)
+		die("can't create SIGCHLD signalfd:");
+#else
+	{
+		struct sigaction sa = { .sa_handler = sigchld, .sa_flags = SA_RESTART | SA_NOCLDSTOP };
+		int i;
+
+		if (pipe(sigpipe) < 0)
+			die("pipe:");
+		for (i = 0; i < 2; i++) {
+			fcntl(sigpipe[i], F_SETFD, FD_CLOEXEC);
+			fcntl(sigpipe[i], F_SETFL, O_NONBLOCK);
+		}
+		sigemptyset(&sa.sa_mask);
+		if (sigaction(SIGCHLD, &sa, NULL) < 0)
+			die("can't install SIGCHLD handler:");
+		sigfd = sigpipe[0];
+	}
+#endif /* __linux__ */
 	while (0 < waitpid(-1, NULL, WNOHANG));
+
+	/* children start with an empty signal mask, default dispositions
+	 * and in a session of their own */
+#ifdef POSIX_SPAWN_SETSID
+	flags |= POSIX_SPAWN_SETSID;
+#else
+	flags |= POSIX_SPAWN_SETPGROUP; /* pgroup 0: a new process group */
+#endif /* POSIX_SPAWN_SETSID */
+	posix_spawnattr_init(&spawnattr);
+	posix_spawnattr_setflags(&spawnattr, flags);
+	sigemptyset(&sm);
+	posix_spawnattr_setsigmask(&spawnattr, &sm);
+	sigaddset(&sm, SIGCHLD);
+	sigaddset(&sm, SIGPIPE);
+	posix_spawnattr_setsigdefault(&spawnattr, &sm);
 }
 
 void
@@ -3508,22 +5906,336 @@ spawn(const Arg *arg)
 {
 	if (arg->v == instantmenucmd)
 		instantmenumon[0] = '0' + selmon->num;
-	if (fork() == 0) {
-		if (dpy)
-			close(ConnectionNumber(dpy));
-		setsid();
-		execvp(((char **)arg->v)[0], (char **)arg->v);
-		fprintf(stderr, "instantwm: execvp %s", ((char **)arg->v)[0]);
-		perror(" failed");
-		exit(EXIT_SUCCESS);
+	spawnv((char *const *)arg->v);
+}
+
+/* 1 for a signed number, 2 for a bare sign which steps by one */
+int
+isincrement(const char *s)
+{
+	if (*s != '+' && *s != '-')
+		return 0;
+	if (!*++s)
+		return 2;
+	for (; *s; s++)
+		if (*s < '0' || *s > '9')
+			return 0;
+	return 1;
+}
+
+int
+cmdlen(char *const *cmd)
+{
+	int n;
+
+	for (n = 0; cmd[n]; n++);
+	return n;
+}
+
+/* commands ending in an increment share a slot when everything but the
+ * increment matches; anything else only coalesces with itself */
+int
+cmdmatch(const CmdQueue *q, char *const *cmd, int numeric)
+{
+	int i, n;
+
+	if (q->cmd == cmd)
+		return 1;
+	if (!numeric || numeric != q->numeric || (n = cmdlen(cmd)) != cmdlen(q->cmd))
+		return 0;
+	for (i = 0; i < n - 1; i++)
+		if (strcmp(cmd[i], q->cmd[i]))
+			return 0;
+	return 1;
+}
+
+void
+cmdqueuerun(CmdQueue *q)
+{
+	char *argv[16], delta[16];
+	int n, step;
+
+	if (q->pid > 0)
+		return;
+	if (q->numeric && q->delta && (n = cmdlen(q->cmd)) < LENGTH(argv)) {
+		memcpy(argv, q->cmd, n * sizeof(char *));
+		/* a bare sign can't carry a sum, run the net steps one by one */
+		step = q->numeric == 2 ? (q->delta > 0 ? 1 : -1) : q->delta;
+		if (q->numeric == 2)
+			snprintf(delta, sizeof delta, "%c", step > 0 ? '+' : '-');
+		else
+			snprintf(delta, sizeof delta, "%+d", step);
+		argv[n - 1] = delta;
+		argv[n] = NULL;
+		q->delta -= step;
+		q->pid = spawnv(argv);
+	} else if (!q->numeric && q->pending) {
+		q->pending = 0;
+		q->pid = spawnv(q->cmd);
+	}
+	if (q->pid <= 0) {
+		q->pid = 0;
+		q->cmd = NULL;
+		q->delta = q->pending = 0; /* a failed spawn drops the rest */
+	}
+}
+
+/* like spawn(), but at most one instance per command runs at a time;
+ * increments arriving meanwhile are summed into the next invocation */
+void
+queuecmd(const Arg *arg)
+{
+	char *const *cmd = (char *const *)arg->v;
+	CmdQueue *q = NULL;
+	int i, numeric;
+
+	reapchildren();
+	numeric = cmdlen(cmd) > 1 ? isincrement(cmd[cmdlen(cmd) - 1]) : 0;
+	for (i = 0; i < LENGTH(cmdqueue) && !q; i++)
+		if (cmdqueue[i].cmd && cmdmatch(&cmdqueue[i], cmd, numeric))
+			q = &cmdqueue[i];
+	for (i = 0; i < LENGTH(cmdqueue) && !q; i++)
+		if (!cmdqueue[i].cmd) {
+			q = &cmdqueue[i];
+			q->cmd = cmd;
+			q->numeric = numeric;
+		}
+	if (!q) {
+		spawn(arg);
+		return;
+	}
+	if (numeric == 2)
+		q->delta += *cmd[cmdlen(cmd) - 1] == '+' ? 1 : -1;
+	else if (numeric)
+		q->delta += atoi(cmd[cmdlen(cmd) - 1]);
+	else
+		q->pending = 1; /* presses during a run fold into one rerun */
+	cmdqueuerun(q);
+}
+
+/* posix_spawn avoids copying the page tables of the window manager and
+ * returns once the child has called exec, which is what gets measured */
+pid_t
+spawnv(char *const argv[])
+{
+	extern char **environ;
+	struct timespec start;
+	pid_t pid;
+	int err;
+
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	if ((err = posix_spawnp(&pid, argv[0], NULL, &spawnattr, argv, environ))) {
+		fprintf(stderr, "instantwm: spawn %s failed: %s\n", argv[0], strerror(err));
+		return -1;
+	}
+	latencyadd(&spawnlatency, &start);
+	return pid;
+}
+
+/* case insensitive subsequence match */
+int
+fuzzymatch(const char *str, const char *pat)
+{
+	for (; *pat; pat++, str++) {
+		while (*str && tolower((unsigned char)*str) != tolower((unsigned char)*pat))
+			str++;
+		if (!*str)
+			return 0;
+	}
+	return 1;
+}
+
+void
+drawswitcher(Window win, Client **list, int n, int sel, int top, int rows, int w, const char *filter)
+{
+	char prompt[sizeof(((Client *)0)->name) + 2];
+	int i;
+
+	snprintf(prompt, sizeof prompt, "> %s", filter);
+	XFTLOCK();
+	drw_setscheme(drw, scheme[SchemeTags]);
+	drw_text(drw, 0, 0, w, bh, lrpad / 2, prompt, 0, 0);
+	drw_copy(drw, win, 0, 0, w, bh, 0, 0);
+	for (i = 0; i < rows; i++) {
+		if (top + i >= n) {
+			drw_setscheme(drw, scheme[SchemeNorm]);
+			drw_rect(drw, 0, 0, w, bh, 1, 1);
+		} else {
+			drw_setscheme(drw, scheme[top + i == sel ? SchemeSel
+				: HIDDEN(list[top + i]) ? SchemeHid : SchemeNorm]);
+			drw_text(drw, 0, 0, w, bh, lrpad / 2, list[top + i]->name, 0, 0);
+		}
+		drw_copy(drw, win, 0, 0, w, bh, 0, (i + 1) * bh);
+	}
+	XFTUNLOCK();
+}
+
+/* built-in window switcher listing the clients in focus order. When it is
+ * opened with a modifier held it behaves like alt-tab and switches once
+ * the modifier is released, otherwise Return or a click selects */
+void
+switcher(const Arg *arg)
+{
+	Client **all, **list, *c;
+	Monitor *m;
+	Window win, dummy;
+	XEvent ev;
+	KeySym ksym;
+	char filter[64] = "", buf[32];
+	int i, len, n = 0, nall = 0, sel, top = 0, rows, w, di, stickymode, refilter = 1;
+	int wx, wy, row;
+	unsigned int mask, holdmask = Mod1Mask|Mod4Mask|ControlMask;
+	XSetWindowAttributes wa = {
+		.override_redirect = True,
+		.background_pixel = scheme[SchemeNorm][ColBg].pixel,
+		.event_mask = ExposureMask|ButtonPressMask
+	};
+
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			nall++;
+	if (!nall)
+		return;
+	all = ecalloc(nall, sizeof(Client *));
+	list = ecalloc(nall, sizeof(Client *));
+	nall = 0;
+	for (c = selmon->stack; c; c = c->snext)
+		all[nall++] = c;
+	for (m = mons; m; m = m->next)
+		if (m != selmon)
+			for (c = m->stack; c; c = c->snext)
+				all[nall++] = c;
+
+	XQueryPointer(dpy, root, &dummy, &dummy, &di, &di, &di, &di, &mask);
+	stickymode = !(mask & holdmask);
+	w = MIN(MAX(selmon->ww / 3, 400), selmon->ww);
+	rows = MIN(nall, selmon->wh / bh - 2);
+	rows = MAX(rows, 1);
+	wx = selmon->wx + (selmon->ww - w) / 2;
+	wy = selmon->wy + (selmon->wh - (rows + 1) * bh) / 2;
+	win = XCreateWindow(dpy, root, wx, wy, w, (rows + 1) * bh, 0,
+			DefaultDepth(dpy, screen), CopyFromParent, DefaultVisual(dpy, screen),
+			CWOverrideRedirect|CWBackPixel|CWEventMask, &wa);
+	if (XGrabKeyboard(dpy, root, True, GrabModeAsync, GrabModeAsync, CurrentTime) != GrabSuccess
+	|| XGrabPointer(dpy, root, False, ButtonPressMask, GrabModeAsync, GrabModeAsync,
+		None, cursor[CurNormal]->cursor, CurrentTime) != GrabSuccess) {
+		XUngrabKeyboard(dpy, CurrentTime);
+		goto out;
+	}
+	XMapRaised(dpy, win);
+	sel = nall > 1;
+	c = NULL;
+
+	for (;;) {
+		if (refilter) {
+			for (i = n = 0; i < nall; i++)
+				if (fuzzymatch(all[i]->name, filter))
+					list[n++] = all[i];
+			sel = MIN(sel, MAX(n - 1, 0));
+			refilter = 0;
+		}
+		if (sel < top)
+			top = sel;
+		else if (sel >= top + rows)
+			top = sel - rows + 1;
+		drawswitcher(win, list, n, sel, top, rows, w, filter);
+
+		XMaskEvent(dpy, KeyPressMask|KeyReleaseMask|ButtonPressMask|ExposureMask|SubstructureRedirectMask, &ev);
+		switch(ev.type) {
+		case ConfigureRequest:
+		case MapRequest:
+			handler[ev.type](&ev);
+			break;
+		case Expose:
+			if (ev.xexpose.window != win)
+				handler[ev.type](&ev);
+			break;
+		case ButtonPress:
+			/* the grab reports every click on root, find the row from
+			 * the root position like overviewcell() does */
+			row = (ev.xbutton.y_root - wy) / bh - 1;
+			if (ev.xbutton.x_root >= wx && ev.xbutton.x_root < wx + w
+			&& ev.xbutton.y_root >= wy + bh && row < rows && top + row < n)
+				c = list[top + row];
+			goto done;
+		case KeyRelease:
+			ksym = XLookupKeysym(&ev.xkey, 0);
+			if (!stickymode && (ksym == XK_Alt_L || ksym == XK_Alt_R
+			|| ksym == XK_Super_L || ksym == XK_Super_R
+			|| ksym == XK_Control_L || ksym == XK_Control_R)) {
+				c = n ? list[sel] : NULL;
+				goto done;
+			}
+			break;
+		case KeyPress:
+			len = XLookupString(&ev.xkey, buf, sizeof buf, &ksym, NULL);
+			switch (ksym) {
+			case XK_Escape:
+				goto done;
+			case XK_Return:
+			case XK_KP_Enter:
+				c = n ? list[sel] : NULL;
+				goto done;
+			case XK_ISO_Left_Tab:
+			case XK_Up:
+				if (n)
+					sel = (sel + n - 1) % n;
+				break;
+			case XK_Tab:
+			case XK_Down:
+				if (n)
+					sel = (ev.xkey.state & ShiftMask ? sel + n - 1 : sel + 1) % n;
+				break;
+			case XK_BackSpace:
+				if (*filter) {
+					filter[strlen(filter) - 1] = '\0';
+					refilter = 1;
+				}
+				break;
+			default:
+				if (len == 1 && !iscntrl((unsigned char)*buf)
+				&& !(ev.xkey.state & holdmask) && strlen(filter) + 1 < sizeof filter) {
+					strncat(filter, buf, 1);
+					sel = 0;
+					refilter = 1;
+				}
+				break;
+			}
+			break;
+		}
+	}
+done:
+	XUngrabPointer(dpy, CurrentTime);
+	XUngrabKeyboard(dpy, CurrentTime);
+out:
+	XDestroyWindow(dpy, win);
+	free(all);
+	free(list);
+	if (c)
+		switchtoclient(c);
+}
+
+/* bring c into view on its monitor and focus it */
+void
+switchtoclient(Client *c)
+{
+	if (c->mon != selmon) {
+		unfocus(selmon->sel, 0);
+		selmon = c->mon;
 	}
+	if (!ISVISIBLE(c))
+		view(&((Arg) { .t = tagbit(tsfirst(c->tags)) }));
+	if (HIDDEN(c))
+		show(c);
+	focus(c);
+	restack(selmon);
 }
 
 void
 tag(const Arg *arg)
 {
-	if (selmon->sel && arg->ui & TAGMASK) {
-		selmon->sel->tags = arg->ui & TAGMASK;
+	if (selmon->sel && tsany(tsand(arg->t, tagmask))) {
+		selmon->sel->tags = tsand(arg->t, tagmask);
 		focus(NULL);
 		arrange(selmon);
 	}
@@ -3573,9 +6285,9 @@ tagtoleft(const Arg *arg) {
 		offset=arg->i;
 
 	if(selmon->sel != NULL
-	&& __builtin_popcount(selmon->tagset[selmon->seltags] & TAGMASK) == 1
-	&& selmon->tagset[selmon->seltags] > 1) {
-		selmon->sel->tags >>= offset;
+	&& tscount(selmon->tagset[selmon->seltags]) == 1
+	&& !tstest(selmon->tagset[selmon->seltags], 0)) {
+		selmon->sel->tags = tsshift(selmon->sel->tags, -offset);
 		focus(NULL);
 		arrange(selmon);
 	}
@@ -3601,9 +6313,9 @@ tagtoright(const Arg *arg) {
 		offset=arg->i;
 
 	if(selmon->sel != NULL
-	&& __builtin_popcount(selmon->tagset[selmon->seltags] & TAGMASK) == 1
-	&& selmon->tagset[selmon->seltags] & (TAGMASK >> 1)) {
-		selmon->sel->tags <<= offset;
+	&& tscount(selmon->tagset[selmon->seltags]) == 1
+	&& !tstest(selmon->tagset[selmon->seltags], LENGTH(tags) - 1)) {
+		selmon->sel->tags = tsand(tsshift(selmon->sel->tags, offset), tagmask);
 		focus(NULL);
 		arrange(selmon);
 	}
@@ -3687,6 +6399,7 @@ togglefakefullscreen(const Arg *arg) {
 	}
 	
 	selmon->sel->isfakefullscreen = !selmon->sel->isfakefullscreen;
+	updategamemode();
 }
 
 void
@@ -3733,17 +6446,22 @@ warpfocus()
 
 void
 moveresize(const Arg *arg) {
+	moveby(arg->i, 1);
+}
+
+void
+moveby(int dir, int n) {
 	/* only floating windows can be moved */
 	Client *c;
 	c = selmon->sel;
 	
-	if (selmon->lt[selmon->sellt]->arrange && !c->isfloating)
+	if (!c || (selmon->lt[selmon->sellt]->arrange && !c->isfloating))
 		return;
 
-	int mstrength = 40;
+	int mstrength = 40 * n;
 	int mpositions[4][2] = {{0, mstrength}, {0, (-1) * mstrength}, {mstrength,0}, {(-1) * mstrength,0}};
-	int nx = (c->x + mpositions[arg->i][0]);
-	int ny = (c->y + mpositions[arg->i][1]);
+	int nx = (c->x + mpositions[dir][0]);
+	int ny = (c->y + mpositions[dir][1]);
 	
 	if (nx < selmon->mx)
 		nx = selmon->mx;
@@ -3762,6 +6480,11 @@ moveresize(const Arg *arg) {
 
 void
 keyresize(const Arg *arg) {
+	resizeby(arg->i, 1);
+}
+
+void
+resizeby(int dir, int n) {
 
 	if (!selmon->sel)
 		return;
@@ -3769,11 +6492,11 @@ keyresize(const Arg *arg) {
 	Client *c;
 	c = selmon->sel;
 
-	int mstrength = 40;
+	int mstrength = 40 * n;
 	int mpositions[4][2] = {{0, mstrength}, {0, (-1) * mstrength}, {mstrength,0}, {(-1) * mstrength,0}};
 
-	int nw = (c->w + mpositions[arg->i][0]);
-	int nh = (c->h + mpositions[arg->i][1]);
+	int nw = (c->w + mpositions[dir][0]);
+	int nh = (c->h + mpositions[dir][1]);
 
 
 	if (selmon->lt[selmon->sellt]->arrange && !c->isfloating)
@@ -3821,8 +6544,11 @@ togglebar(const Arg *arg)
 {
 	selmon->showbar = selmon->pertag->showbars[selmon->pertag->curtag] = !selmon->showbar;
 	updatebarpos(selmon);
+	if (systray)
+		systray->w = 0; /* restack it over the moved bar, see updatesystray() */
+	updatesystray();
 	resizebarwin(selmon);
-	if (showsystray) {
+	if (showsystray && systray) {
 		XWindowChanges wc;
 		if (!selmon->showbar)
 			wc.y = -bh;
@@ -3832,6 +6558,7 @@ togglebar(const Arg *arg)
 				wc.y = selmon->mh - bh;
 		}
 		XConfigureWindow(dpy, systray->win, CWY, &wc);
+		systray->y = wc.y;
 	}
 	arrange(selmon);
 }
@@ -3886,12 +6613,12 @@ changefloating(Client *c)
 void
 toggletag(const Arg *arg)
 {
-	unsigned int newtags;
+	Tagset newtags;
 
 	if (!selmon->sel)
 		return;
-	newtags = selmon->sel->tags ^ (arg->ui & TAGMASK);
-	if (newtags) {
+	newtags = tsxor(selmon->sel->tags, tsand(arg->t, tagmask));
+	if (tsany(newtags)) {
 		selmon->sel->tags = newtags;
 		focus(NULL);
 		arrange(selmon);
@@ -3901,22 +6628,20 @@ toggletag(const Arg *arg)
 void
 toggleview(const Arg *arg)
 {
-	unsigned int newtagset = selmon->tagset[selmon->seltags] ^ (arg->ui & TAGMASK);
-	int i;
+	Tagset newtagset = tsxor(selmon->tagset[selmon->seltags], tsand(arg->t, tagmask));
 
-	if (newtagset) {
+	if (tsany(newtagset)) {
 		selmon->tagset[selmon->seltags] = newtagset;
 
-		if (newtagset == ~0) {
+		if (tsequal(newtagset, tagmask)) {
 			selmon->pertag->prevtag = selmon->pertag->curtag;
 			selmon->pertag->curtag = 0;
 		}
 
 		/* test if the user did not select the same tag */
-		if (!(newtagset & 1 << (selmon->pertag->curtag - 1))) {
+		if (!tstest(newtagset, selmon->pertag->curtag - 1)) {
 			selmon->pertag->prevtag = selmon->pertag->curtag;
-			for (i = 0; !(newtagset & 1 << i); i++) ;
-			selmon->pertag->curtag = i + 1;
+			selmon->pertag->curtag = tsfirst(newtagset) + 1;
 		}
 
 		/* apply settings for this view */
@@ -3947,12 +6672,20 @@ void hidewin(const Arg *arg)
 void
 unhideall(const Arg *arg) {
 
-	Client *c;
+	Client *c, **cs;
+	int n = 0;
+
+	for (c = selmon->clients; c; c = c->next)
+		n++;
+	cs = ecalloc(MAX(n, 1), sizeof(Client *));
+	n = 0;
 	for (c = selmon->clients; c; c = c->next) {
 		if (ISVISIBLE(c) && HIDDEN(c))
-			show(c);
+			cs[n++] = c;
 	}
-	focus(c);
+	showclients(cs, n);
+	free(cs);
+	focus(NULL);
 	restack(selmon);
 
 }
@@ -3998,17 +6731,31 @@ unmanage(Client *c, int destroyed)
 
 	detach(c);
 	detachstack(c);
+	thaw(c);
+	if (c->pgid)
+		setnice(c, c->orignice);
 	if (!destroyed) {
 		wc.border_width = c->oldbw;
-		XGrabServer(dpy); /* avoid race conditions */
+		/* the window may be gone already, errors are dropped until the sync */
 		XSetErrorHandler(xerrordummy);
 		XConfigureWindow(dpy, c->win, CWBorderWidth, &wc); /* restore border */
 		XUngrabButton(dpy, AnyButton, AnyModifier, c->win);
 		setclientstate(c, WithdrawnState);
+#ifdef COMPOSITE
+		if (c->damage)
+			XDamageDestroy(dpy, c->damage);
+		setredirect(c, 0);
+#endif /* COMPOSITE */
 		XSync(dpy, False);
 		XSetErrorHandler(xerror);
-		XUngrabServer(dpy);
 	}
+#ifdef COMPOSITE
+	if (c->thumbpict) {
+		XRenderFreePicture(dpy, c->thumbpict);
+		XFreePixmap(dpy, c->thumb);
+	}
+#endif /* COMPOSITE */
+	freeicon(c);
 	free(c);
 	focus(NULL);
 	updateclientlist();
@@ -4022,6 +6769,13 @@ unmapnotify(XEvent *e)
 	XUnmapEvent *ev = &e->xunmap;
 
 	if ((c = wintoclient(ev->window))) {
+		/* an unmap of ours is reported on the window first and on root
+		 * after that, only the last one settles the ledger */
+		if (c->ignoreunmap && !ev->send_event) {
+			if (ev->event == root)
+				c->ignoreunmap--;
+			return;
+		}
 		if (ev->send_event)
 			setclientstate(c, WithdrawnState);
 		else
@@ -4039,6 +6793,7 @@ void
 updatebars(void)
 {
 	unsigned int w;
+	int raised = 0;
 	Monitor *m;
 	XSetWindowAttributes wa = {
 		.override_redirect = True,
@@ -4060,6 +6815,13 @@ updatebars(void)
 			XMapRaised(dpy, systray->win);
 		XMapRaised(dpy, m->barwin);
 		XSetClassHint(dpy, m->barwin, &ch);
+		clockupdate(m);
+		raised = 1;
+	}
+	/* a new bar covers the tray, restack it even if it did not move */
+	if (raised && systray) {
+		systray->w = 0;
+		updatesystray();
 	}
 }
 
@@ -4077,24 +6839,270 @@ updatebarpos(Monitor *m)
 }
 
 void
-updateclientlist()
+updateclientlist()
+{
+	Client *c;
+	Monitor *m;
+
+	XDeleteProperty(dpy, root, netatom[NetClientList]);
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			XChangeProperty(dpy, root, netatom[NetClientList],
+				XA_WINDOW, 32, PropModeAppend,
+				(unsigned char *) &(c->win), 1);
+}
+
+/* find the process group behind c through _NET_WM_PID, provided the
+ * client runs on this machine and not in our own process group */
+void
+initprocess(Client *c)
+{
+	char host[256], machine[256];
+	unsigned char *p = NULL;
+	unsigned long n, extra;
+	int format, nice;
+	Atom type;
+	pid_t pid = 0, pgid;
+	Client *t;
+	Monitor *m;
+
+	if (XGetWindowProperty(dpy, c->win, netatom[NetWMPid], 0L, 1L, False, XA_CARDINAL,
+		&type, &format, &n, &extra, &p) == Success && p) {
+		if (n && format == 32)
+			pid = *(long *)p;
+		XFree(p);
+	}
+	if (pid <= 0 || gethostname(host, sizeof host) < 0
+	|| !gettextprop(c->win, XA_WM_CLIENT_MACHINE, machine, sizeof machine)
+	|| strncmp(host, machine, sizeof host))
+		return;
+	if ((pgid = getpgid(pid)) <= 0 || pgid == getpgrp())
+		return;
+	/* the group may already be adjusted for one of its other windows */
+	for (m = mons; m; m = m->next)
+		for (t = m->clients; t; t = t->next)
+			if (t->pgid == pgid) {
+				c->pgid = pgid;
+				c->nice = t->nice;
+				c->orignice = t->orignice;
+				c->frozen = t->frozen;
+				return;
+			}
+	errno = 0;
+	nice = getpriority(PRIO_PGRP, pgid);
+	c->pgid = pgid;
+	c->nice = c->orignice = errno ? 0 : nice;
+}
+
+/* set the nice level of the process group of c and note it on every
+ * client sharing the group */
+void
+setnice(Client *c, int nice)
+{
+	Monitor *m;
+	Client *t;
+
+	if (c->nice == nice)
+		return;
+	if (setpriority(PRIO_PGRP, c->pgid, nice) < 0) {
+		if (errno == ESRCH)
+			c->pgid = 0;
+		return;
+	}
+	for (m = mons; m; m = m->next)
+		for (t = m->clients; t; t = t->next)
+			if (t->pgid == c->pgid)
+				t->nice = nice;
+	c->nice = nice;
+}
+
+/* the focused client's group gets nicefocused, groups whose clients are
+ * all on hidden tags or iconified get nicebackground */
+void
+updatepriorities(void)
+{
+	Monitor *m;
+	Client *c, **v;
+	int i, j, k, n = 0, focused, visible, nice;
+
+	if (!schedfocus)
+		return;
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			n += c->pgid != 0;
+	if (!n)
+		return;
+	v = ecalloc(n, sizeof(Client *));
+	n = 0;
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			if (c->pgid)
+				v[n++] = c;
+	/* sorted by group, each run of equal pgids is handled once */
+	qsort(v, n, sizeof(Client *), pgidcmp);
+	for (i = 0; i < n; i = j) {
+		focused = visible = 0;
+		for (j = i; j < n && v[j]->pgid == v[i]->pgid; j++) {
+			focused |= v[j] == selmon->sel;
+			if (!visible && ISVISIBLE(v[j]) && !HIDDEN(v[j]))
+				visible = 1;
+		}
+		c = v[i];
+		if (c->orignice < minnice)
+			continue; /* could not be restored */
+		if (focused)
+			nice = MAX(MIN(nicefocused, c->orignice), minnice);
+		else if (!visible)
+			nice = MAX(nicebackground, c->orignice);
+		else
+			nice = c->orignice;
+		if (c->nice == nice)
+			continue;
+		if (setpriority(PRIO_PGRP, c->pgid, nice) < 0) {
+			if (errno == ESRCH)
+				for (k = i; k < j; k++)
+					v[k]->pgid = 0;
+			continue;
+		}
+		for (k = i; k < j; k++)
+			v[k]->nice = nice;
+	}
+	free(v);
+}
+
+int
+pgidcmp(const void *a, const void *b)
+{
+	pid_t x = (*(Client *const *)a)->pgid, y = (*(Client *const *)b)->pgid;
+
+	return (x > y) - (x < y);
+}
+
+/* milliseconds until the next hidden client is due to be frozen, -1 if
+ * there is none */
+int
+freezetimeout(void)
+{
+	Monitor *m;
+	Client *c;
+	struct timespec now;
+	long ms, timeout = -1;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next) {
+			if (!c->freeze || !c->pgid || c->frozen || !c->hidden.tv_sec)
+				continue;
+			ms = (c->hidden.tv_sec + freezedelay - now.tv_sec) * 1000
+				+ (c->hidden.tv_nsec - now.tv_nsec) / 1000000;
+			ms = MAX(ms, 0);
+			if (timeout < 0 || ms < timeout)
+				timeout = ms;
+		}
+	return timeout;
+}
+
+/* stop the process groups of clients that have been hidden for longer
+ * than freezedelay, unless the group has a window on a visible tag */
+void
+freezeclients(void)
+{
+	Monitor *m, *m2;
+	Client *c, *t;
+	struct timespec now, start;
+	int visible;
+
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next) {
+			if (!c->freeze || !c->pgid || c->frozen || !c->hidden.tv_sec
+			|| now.tv_sec - c->hidden.tv_sec < freezedelay)
+				continue;
+			/* every client has its pgid looked up while freezerules is
+			 * set; one without (pgid 0) is unknown and never matches */
+			visible = 0;
+			for (m2 = mons; m2; m2 = m2->next)
+				for (t = m2->clients; t; t = t->next)
+					visible |= t->pgid == c->pgid && ISVISIBLE(t);
+			if (visible) {
+				c->hidden.tv_sec = 0;
+				continue;
+			}
+			clock_gettime(CLOCK_MONOTONIC, &start);
+			if (kill(-c->pgid, SIGSTOP) < 0) {
+				c->freeze = 0;
+				continue;
+			}
+			latencyadd(&freezelatency, &start);
+			for (m2 = mons; m2; m2 = m2->next)
+				for (t = m2->clients; t; t = t->next)
+					if (t->pgid == c->pgid)
+						t->frozen = 1;
+		}
+}
+
+/* continue the process group of c if it was frozen */
+void
+thaw(Client *c)
+{
+	Monitor *m;
+	Client *t;
+	struct timespec start;
+
+	if (!c->frozen)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	kill(-c->pgid, SIGCONT);
+	latencyadd(&thawlatency, &start);
+	for (m = mons; m; m = m->next)
+		for (t = m->clients; t; t = t->next)
+			if (t->pgid == c->pgid) {
+				t->frozen = 0;
+				t->hidden.tv_sec = 0;
+			}
+	c->frozen = 0;
+	c->hidden.tv_sec = 0;
+}
+
+/* a monitor whose focused client is truly fullscreen drops everything
+ * that only serves the bar: root pointer motion, bar drawing, title and
+ * status reads and animations. They are caught up on leaving */
+void
+updategamemode(void)
 {
-	Client *c;
 	Monitor *m;
+	Client *c;
+	long mask;
 
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
-	for (m = mons; m; m = m->next)
-		for (c = m->clients; c; c = c->next)
-			XChangeProperty(dpy, root, netatom[NetClientList],
-				XA_WINDOW, 32, PropModeAppend,
-				(unsigned char *) &(c->win), 1);
+	for (m = mons; m; m = m->next) {
+		c = m->sel;
+		if (m->gamemode == (c && c->isfullscreen && !c->isfakefullscreen && ISVISIBLE(c)))
+			continue;
+		if (!(m->gamemode = !m->gamemode) && m->deferred) {
+			m->deferred = 0;
+			for (c = m->clients; c; c = c->next)
+				updatetitle(c);
+			drawbar(m);
+		}
+	}
+	mask = selmon->gamemode ? ROOTMASK : ROOTMASK|PointerMotionMask;
+	if (mask != rootmask)
+		XSelectInput(dpy, root, rootmask = mask);
+	if (statusdeferred && !selmon->gamemode)
+		updatestatus();
 }
 
 int
 updategeom(void)
 {
 	int dirty = 0;
+#ifdef RANDR
+	int r;
 
+	if (randr && (r = updaterandr()) >= 0)
+		dirty = r;
+	else
+#endif /* RANDR */
 #ifdef XINERAMA
 	if (XineramaIsActive(dpy)) {
 		int i, j, n, nn;
@@ -4125,6 +7133,7 @@ updategeom(void)
 				|| unique[i].width != m->mw || unique[i].height != m->mh)
 				{
 					dirty = 1;
+					m->changed = 1;
 					m->num = i;
 					m->mx = m->wx = unique[i].x_org;
 					m->my = m->wy = unique[i].y_org;
@@ -4137,6 +7146,7 @@ updategeom(void)
 				for (m = mons; m && m->next; m = m->next);
 				while ((c = m->clients)) {
 					dirty = 1;
+					mons->changed = 1;
 					m->clients = c->next;
 					detachstack(c);
 					c->mon = mons;
@@ -4156,6 +7166,8 @@ updategeom(void)
 			mons = createmon();
 		if (mons->mw != sw || mons->mh != sh) {
 			dirty = 1;
+			mons->changed = 1;
+			mons->mx = mons->my = 0;
 			mons->mw = mons->ww = sw;
 			mons->mh = mons->wh = sh;
 			updatebarpos(mons);
@@ -4168,6 +7180,194 @@ updategeom(void)
 	return dirty;
 }
 
+/* Fetch _NET_WM_ICON and scale it once, redraws only blit the result.
+ * The raw property can be megabytes, it is dropped right away and only
+ * iconcachesize scaled icons are kept, least recently drawn go first. */
+void
+updateicon(Client *c)
+{
+	Atom type;
+	int format;
+	unsigned long i, n, extra, w, h, d, *p = NULL, *best = NULL;
+	unsigned int size = bh - 8; /* as tall as the close button */
+	Monitor *m;
+	Client *t, *lru;
+
+	freeicon(c);
+	c->hasicon = c->iconstale = 0;
+	if (XGetWindowProperty(dpy, c->win, netatom[NetWMIcon], 0L, LONG_MAX, False, XA_CARDINAL,
+		&type, &format, &n, &extra, (unsigned char **)&p) != Success || !p)
+		return;
+	/* width, height and the pixels, for each size the client offers; take
+	 * the smallest one that needs no upscaling, else the largest */
+	for (i = 0; format == 32 && n - i > 2; i += 2 + w * h) {
+		w = p[i];
+		h = p[i + 1];
+		if (!w || !h || w > 0xffff || h > 0xffff || w * h > n - i - 2)
+			break;
+		d = MAX(w, h);
+		if (!best || (MAX(best[0], best[1]) < size ? d > MAX(best[0], best[1])
+		              : d >= size && d < MAX(best[0], best[1])))
+			best = p + i;
+	}
+	if (best && (c->icon = drw_icon_create(drw, best + 2, best[0], best[1], size))) {
+		c->hasicon = 1;
+		c->iconstamp = ++iconclock;
+		iconcount++;
+	}
+	XFree(p);
+
+	/* icons of clients on screen stay, the cap may be exceeded while
+	 * more titles are visible than it allows */
+	while (iconcount > iconcachesize) {
+		lru = NULL;
+		for (m = mons; m; m = m->next)
+			for (t = m->clients; t; t = t->next)
+				if (t->icon && t != c && !ISVISIBLE(t)
+				&& (!lru || t->iconstamp < lru->iconstamp))
+					lru = t;
+		if (!lru)
+			break;
+		freeicon(lru);
+	}
+}
+
+
+#ifdef RANDR
+/* match the active outputs against the monitors by output id. Monitors
+ * of surviving outputs keep their clients and are only marked changed if
+ * their geometry differs, monitors of vanished outputs hand their clients
+ * to the first remaining one. Returns -1 if RandR reports no usable
+ * output, the number of changes otherwise */
+int
+updaterandr(void)
+{
+	XRRScreenResources *sr;
+	XRROutputInfo *oi;
+	XRRCrtcInfo *ci;
+	XRRModeInfo *mi;
+	RROutput *outputs;
+	XRectangle *geoms;
+	double *rates;
+	int i, j, k, n = 0, dirty = 0;
+	Monitor *m, *next, *target;
+	Client *c;
+
+	if (!(sr = XRRGetScreenResourcesCurrent(dpy, root)))
+		return -1;
+	outputs = ecalloc(sr->noutput, sizeof(RROutput));
+	geoms = ecalloc(sr->noutput, sizeof(XRectangle));
+	rates = ecalloc(sr->noutput, sizeof(double));
+	for (i = 0; i < sr->noutput; i++) {
+		if (!(oi = XRRGetOutputInfo(dpy, sr, sr->outputs[i])))
+			continue;
+		if (oi->connection == RR_Connected && oi->crtc
+		&& (ci = XRRGetCrtcInfo(dpy, sr, oi->crtc))) {
+			/* mirrored outputs share a geometry, keep one of them */
+			for (j = 0; j < n; j++)
+				if (geoms[j].x == ci->x && geoms[j].y == ci->y
+				&& geoms[j].width == ci->width && geoms[j].height == ci->height)
+					break;
+			if (j == n && ci->width && ci->height) {
+				outputs[n] = sr->outputs[i];
+				geoms[n].x = ci->x;
+				geoms[n].y = ci->y;
+				geoms[n].width = ci->width;
+				geoms[n].height = ci->height;
+				for (k = 0; k < sr->nmode; k++) {
+					mi = &sr->modes[k];
+					if (mi->id != ci->mode || !mi->hTotal || !mi->vTotal)
+						continue;
+					rates[n] = (double)mi->dotClock / ((double)mi->hTotal * mi->vTotal);
+					if (mi->modeFlags & RR_DoubleScan)
+						rates[n] /= 2;
+					if (mi->modeFlags & RR_Interlace)
+						rates[n] *= 2;
+				}
+				n++;
+			}
+			XRRFreeCrtcInfo(ci);
+		}
+		XRRFreeOutputInfo(oi);
+	}
+	XRRFreeScreenResources(sr);
+	if (!n) {
+		free(outputs);
+		free(geoms);
+		free(rates);
+		return -1;
+	}
+
+	/* surviving outputs */
+	for (m = mons; m; m = m->next) {
+		for (i = 0; i < n && outputs[i] != m->output; i++);
+		if (i == n) {
+			m->output = None;
+			continue;
+		}
+		/* a new mode at the same size only re-targets the clock */
+		if (m->refresh != rates[i]) {
+			m->refresh = rates[i];
+			clockupdate(m);
+		}
+		if (geoms[i].x != m->mx || geoms[i].y != m->my
+		|| geoms[i].width != m->mw || geoms[i].height != m->mh) {
+			dirty++;
+			m->changed = 1;
+			m->mx = m->wx = geoms[i].x;
+			m->my = m->wy = geoms[i].y;
+			m->mw = m->ww = geoms[i].width;
+			m->mh = m->wh = geoms[i].height;
+			updatebarpos(m);
+		}
+		outputs[i] = None;
+	}
+	/* new outputs */
+	for (i = 0; i < n; i++) {
+		if (outputs[i] == None)
+			continue;
+		for (m = mons; m && m->next; m = m->next);
+		if (m)
+			m = m->next = createmon();
+		else
+			m = mons = createmon();
+		dirty++;
+		m->changed = 1;
+		m->output = outputs[i];
+		m->refresh = rates[i];
+		m->mx = m->wx = geoms[i].x;
+		m->my = m->wy = geoms[i].y;
+		m->mw = m->ww = geoms[i].width;
+		m->mh = m->wh = geoms[i].height;
+		updatebarpos(m);
+	}
+	/* vanished outputs */
+	for (target = mons; target && target->output == None; target = target->next);
+	for (m = mons; m; m = next) {
+		next = m->next;
+		if (m->output != None)
+			continue;
+		dirty++;
+		while ((c = m->clients)) {
+			m->clients = c->next;
+			detachstack(c);
+			c->mon = target;
+			attach(c);
+			attachstack(c);
+			target->changed = 1;
+		}
+		if (m == selmon)
+			selmon = target;
+		cleanupmon(m);
+	}
+	for (i = 0, m = mons; m; m = m->next, i++)
+		m->num = i;
+	free(outputs);
+	free(geoms);
+	free(rates);
+	return dirty;
+}
+#endif /* RANDR */
 
 // fix issues with custom window borders
 void
@@ -4230,6 +7430,7 @@ updatesizehints(Client *c)
 	if (!XGetWMNormalHints(dpy, c->win, &size, &msize))
 		/* size is uninitialized, ensure that size.flags aren't used */
 		size.flags = PSize;
+	c->userpos = !!(size.flags & USPosition);
 	if (size.flags & PBaseSize) {
 		c->basew = size.base_width;
 		c->baseh = size.base_height;
@@ -4267,10 +7468,14 @@ updatesizehints(Client *c)
 void
 updatestatus(void)
 {
+	if (selmon->gamemode) {
+		statusdeferred = 1;
+		return;
+	}
+	statusdeferred = 0;
 	if (!gettextprop(root, XA_WM_NAME, stext, sizeof(stext)))
 		strcpy(stext, "instantwm-"VERSION);
-	drawbar(selmon);
-	updatesystray();
+	deferbar(selmon);
 }
 
 void
@@ -4306,14 +7511,14 @@ updatesystrayiconstate(Client *i, XPropertyEvent *ev)
 			!(flags = getatomprop(i, xatom[XembedInfo])))
 		return;
 
-	if (flags & XEMBED_MAPPED && !i->tags) {
-		i->tags = 1;
+	if (flags & XEMBED_MAPPED && !tsany(i->tags)) {
+		i->tags = tagbit(0);
 		code = XEMBED_WINDOW_ACTIVATE;
 		XMapRaised(dpy, i->win);
 		setclientstate(i, NormalState);
 	}
-	else if (!(flags & XEMBED_MAPPED) && i->tags) {
-		i->tags = 0;
+	else if (!(flags & XEMBED_MAPPED) && tsany(i->tags)) {
+		i->tags = (Tagset){{ 0 }};
 		code = XEMBED_WINDOW_DEACTIVATE;
 		XUnmapWindow(dpy, i->win);
 		setclientstate(i, WithdrawnState);
@@ -4361,30 +7566,33 @@ updatesystray(void)
 			return;
 		}
 	}
+	/* only icons and a tray whose layout changed are touched, the
+	 * background of both is painted by the server */
 	for (w = 0, i = systray->icons; i; i = i->next) {
-		/* make sure the background color stays the same */
-		wa.background_pixel  = scheme[SchemeNorm][ColBg].pixel;
-		XChangeWindowAttributes(dpy, i->win, CWBackPixel, &wa);
-		XMapRaised(dpy, i->win);
 		w += systrayspacing;
 		i->x = w;
-		XMoveResizeWindow(dpy, i->win, i->x, 0, i->w, i->h);
+		if (!i->trayw)
+			XMapRaised(dpy, i->win); /* newly docked */
+		if (i->trayx != i->x || i->trayw != i->w || i->trayh != i->h) {
+			XMoveResizeWindow(dpy, i->win, i->x, 0, i->w, i->h);
+			i->trayx = i->x;
+			i->trayw = i->w;
+			i->trayh = i->h;
+		}
 		w += i->w;
-		if (i->mon != m)
-			i->mon = m;
+		i->mon = m;
 	}
 	w = w ? w + systrayspacing : 1;
 	x -= w;
-	XMoveResizeWindow(dpy, systray->win, x, m->by, w, bh);
-	wc.x = x; wc.y = m->by; wc.width = w; wc.height = bh;
-	wc.stack_mode = Above; wc.sibling = m->barwin;
-	XConfigureWindow(dpy, systray->win, CWX|CWY|CWWidth|CWHeight|CWSibling|CWStackMode, &wc);
-	XMapWindow(dpy, systray->win);
-	XMapSubwindows(dpy, systray->win);
-	/* redraw background */
-	XSetForeground(dpy, drw->gc, scheme[SchemeNorm][ColBg].pixel);
-	XFillRectangle(dpy, systray->win, drw->gc, 0, 0, w, bh);
-	XSync(dpy, False);
+	if (systray->mon != m || systray->x != x || systray->y != m->by || systray->w != w) {
+		wc.x = x; wc.y = m->by; wc.width = w; wc.height = bh;
+		wc.stack_mode = Above; wc.sibling = m->barwin;
+		XConfigureWindow(dpy, systray->win, CWX|CWY|CWWidth|CWHeight|CWSibling|CWStackMode, &wc);
+		systray->mon = m;
+		systray->x = x;
+		systray->y = m->by;
+		systray->w = w;
+	}
 }
 
 void
@@ -4394,6 +7602,11 @@ updatetitle(Client *c)
 		gettextprop(c->win, XA_WM_NAME, c->name, sizeof c->name);
 	if (c->name[0] == '\0') /* hack to mark broken clients */
 		strcpy(c->name, broken);
+#ifndef BARTHREAD
+	/* the bar renderer has fonts of its own to warm up */
+	c->titlewarm = 0;
+	idlequeue(IdleTitles);
+#endif /* BARTHREAD */
 }
 
 void
@@ -4430,19 +7643,17 @@ updatewmhints(Client *c)
 void
 view(const Arg *arg)
 {
-	int i;
+	Tagset t = tsand(arg->t, tagmask);
 
 	selmon->seltags ^= 1; /* toggle sel tagset */
-	if (arg->ui & TAGMASK) {
-		selmon->tagset[selmon->seltags] = arg->ui & TAGMASK;
+	if (tsany(t)) {
+		selmon->tagset[selmon->seltags] = t;
 		selmon->pertag->prevtag = selmon->pertag->curtag;
 
-		if (arg->ui == ~0)
+		if (tsequal(t, tagmask))
 			selmon->pertag->curtag = 0;
-		else {
-			for (i = 0; !(arg->ui & 1 << i); i++) ;
-			selmon->pertag->curtag = i + 1;
-		}
+		else
+			selmon->pertag->curtag = tsfirst(t) + 1;
 	} else {
 		unsigned int tmptag;
 		tmptag = selmon->pertag->prevtag;
@@ -4469,49 +7680,151 @@ moveleft(const Arg *arg) {
 	viewtoleft(arg);	
 }
 
+void
 animleft(const Arg *arg) {
+	slideview(arg, viewtoleft, -1);
+}
+
+void
+animright(const Arg *arg) {
+	slideview(arg, viewtoright, 1);
+}
+
+#ifdef COMPOSITE
+/* compose the visible clients of m from their redirected pixmaps, in
+ * stacking order, on top of the wallpaper */
+Pixmap
+snapshotview(Monitor *m)
+{
+	Window d1, d2, *wins = NULL;
+	unsigned int i, num;
+	unsigned char *p = NULL;
+	unsigned long n, extra;
+	int format;
+	Atom type;
+	Pixmap to, pix;
+	Picture dst, src;
+	XRenderPictFormat *fmt = XRenderFindVisualFormat(dpy, DefaultVisual(dpy, screen));
 	Client *c;
-	if (!selmon->sel || clientcount() != 1) {
-		viewtoleft(arg);
-		return;
-	}
-	c = selmon->sel;
 
-	animateclient(c, c->x + 50, c->y, 0,0,10,1);
-	viewtoleft(arg);
+	to = XCreatePixmap(dpy, root, m->ww, m->wh, DefaultDepth(dpy, screen));
+	dst = XRenderCreatePicture(dpy, to, fmt, 0, NULL);
+	XRenderFillRectangle(dpy, PictOpSrc, dst, &scheme[SchemeNorm][ColBg].color, 0, 0, m->ww, m->wh);
+
+	XSetErrorHandler(xerrordummy);
+	if (XGetWindowProperty(dpy, root, rootpmapatom, 0L, 1L, False, XA_PIXMAP,
+		&type, &format, &n, &extra, &p) == Success && p) {
+		if (n && format == 32)
+			XCopyArea(dpy, *(Pixmap *)p, to, drw->gc, m->wx, m->wy, m->ww, m->wh, 0, 0);
+		XFree(p);
+	}
+	if (XQueryTree(dpy, root, &d1, &d2, &wins, &num)) {
+		/* bottom to top */
+		for (i = 0; i < num; i++) {
+			if (!(c = wintoclient(wins[i])) || c->mon != m || !ISVISIBLE(c) || !c->redirected)
+				continue;
+			pix = XCompositeNameWindowPixmap(dpy, c->win);
+			src = XRenderCreatePicture(dpy, pix, c->format, 0, NULL);
+			XRenderComposite(dpy, PictOpOver, src, None, dst, 0, 0, 0, 0,
+				c->x - m->wx, c->y - m->wy, WIDTH(c), HEIGHT(c));
+			XRenderFreePicture(dpy, src);
+			XFreePixmap(dpy, pix);
+		}
+		if (wins)
+			XFree(wins);
+	}
+	XSync(dpy, False);
+	XSetErrorHandler(xerror);
+	XRenderFreePicture(dpy, dst);
+	return to;
 }
+#endif /* COMPOSITE */
 
+/* switch views with switchfn, sliding the outgoing view out in direction
+ * dir. The outgoing view is captured into a pixmap shown on an
+ * override-redirect window while the real windows are switched underneath
+ * in one go, so nothing but the snapshot moves. If the incoming view can
+ * be composed from redirected clients it slides in alongside */
+void
+slideview(const Arg *arg, void (*switchfn)(const Arg *), int dir)
+{
+	Monitor *m = selmon;
+	Tagset oldtags = m->tagset[m->seltags];
+	Pixmap from, to = None;
+	Window win;
+	GC gc;
+	XGCValues gcv = { .subwindow_mode = IncludeInferiors, .graphics_exposures = False };
+	XSetWindowAttributes wa;
+	int i, off, frames = 10;
 
-animright(const Arg *arg) {
-	Client *c;
-	if (!selmon->sel || clientcount() != 1) {
-		viewtoright(arg);
+	if (!animated) {
+		switchfn(arg);
 		return;
 	}
-	c = selmon->sel;
-
-	animateclient(c, c->x - 50, c->y, 0,0,10,1);
-	viewtoright(arg);
+	gc = XCreateGC(dpy, root, GCSubwindowMode|GCGraphicsExposures, &gcv);
+	from = XCreatePixmap(dpy, root, m->ww, m->wh, DefaultDepth(dpy, screen));
+	XCopyArea(dpy, root, from, gc, m->wx, m->wy, m->ww, m->wh, 0, 0);
+	wa.override_redirect = True;
+	wa.background_pixmap = from;
+	win = XCreateWindow(dpy, root, m->wx, m->wy, m->ww, m->wh, 0, DefaultDepth(dpy, screen),
+			CopyFromParent, DefaultVisual(dpy, screen), CWOverrideRedirect|CWBackPixmap, &wa);
+	XMapRaised(dpy, win);
+
+	animated = 0;
+	switchfn(arg);
+	animated = 1;
+	if (tsequal(m->tagset[m->seltags], oldtags))
+		goto out;
+	XRaiseWindow(dpy, win); /* restack() may have raised floating clients */
+	XSetWindowBackgroundPixmap(dpy, win, None);
+#ifdef COMPOSITE
+	if (composite)
+		to = snapshotview(m);
+#endif /* COMPOSITE */
+
+	clockstart(m);
+	for (i = 1; i < frames; i++) {
+		off = easeOutQuint((double)i / frames) * m->ww;
+		if (to) {
+			XCopyArea(dpy, from, win, gc, 0, 0, m->ww, m->wh, -dir * off, 0);
+			XCopyArea(dpy, to, win, gc, 0, 0, m->ww, m->wh, dir * (m->ww - off), 0);
+		} else {
+			/* shrink the snapshot window, uncovering the real windows */
+			XMoveResizeWindow(dpy, win, m->wx + (dir < 0 ? off : 0), m->wy, m->ww - off, m->wh);
+			XCopyArea(dpy, from, win, gc, dir > 0 ? off : 0, 0, m->ww - off, m->wh, 0, 0);
+		}
+		XSync(dpy, False);
+		waitframe(m);
+	}
+out:
+	XDestroyWindow(dpy, win);
+	XFreePixmap(dpy, from);
+	if (to)
+		XFreePixmap(dpy, to);
+	XFreeGC(dpy, gc);
 }
 
 
 
 void
 viewtoleft(const Arg *arg) {
-	int i;
+	viewby(-1);
+}
 
-	if(__builtin_popcount(selmon->tagset[selmon->seltags] & TAGMASK) == 1
-	&& selmon->tagset[selmon->seltags] > 1) {
+/* moves a single selected tag by d, stopping at the first and last tag */
+void
+viewby(int d) {
+	int cur;
+
+	if(tscount(selmon->tagset[selmon->seltags]) != 1)
+		return;
+	cur = tsfirst(selmon->tagset[selmon->seltags]);
+	d = MAX(MIN(cur + d, (int)LENGTH(tags) - 1), 0) - cur;
+	if (d) {
 		selmon->seltags ^= 1; /* toggle sel tagset */
-		selmon->tagset[selmon->seltags] = selmon->tagset[selmon->seltags ^ 1] >> 1;
+		selmon->tagset[selmon->seltags] = tsshift(selmon->tagset[selmon->seltags ^ 1], d);
 		selmon->pertag->prevtag = selmon->pertag->curtag;
-
-		if (selmon->tagset[selmon->seltags ^ 1] >> 1 == ~0)
-			selmon->pertag->curtag = 0;
-		else {
-			for (i = 0; !(selmon->tagset[selmon->seltags ^ 1] >> 1 & 1 << i); i++) ;
-			selmon->pertag->curtag = i + 1;
-		}
+		selmon->pertag->curtag = tsfirst(selmon->tagset[selmon->seltags]) + 1;
 
 		selmon->nmaster = selmon->pertag->nmasters[selmon->pertag->curtag];
 		selmon->mfact = selmon->pertag->mfacts[selmon->pertag->curtag];
@@ -4531,32 +7844,43 @@ viewtoleft(const Arg *arg) {
 
 void
 shiftview(const Arg *arg)
+{
+	shiftby(arg->i, 1);
+}
+
+/* n shifts by d, each to the next occupied tags, with a single view() */
+void
+shiftby(int d, int n)
 {
 	Arg a;
 	Client *c;
-	unsigned visible = 0;
-	int i = arg->i;
-	int count = 0;
-	int nextseltags, curseltags = selmon->tagset[selmon->seltags];
-
-	do {
-		if(i > 0) // left circular shift
-			nextseltags = (curseltags << i) | (curseltags >> (LENGTH(tags) - i));
+	unsigned visible;
+	int i;
+	int count;
+	Tagset nextseltags, curseltags = selmon->tagset[selmon->seltags];
 
-		else // right circular shift
-			nextseltags = curseltags >> (- i) | (curseltags << (LENGTH(tags) + i));
+	for (; n > 0; n--) {
+		visible = 0;
+		i = d;
+		count = 0;
+		do {
+			nextseltags = tsrotate(curseltags, i);
 
-                // Check if tag is visible
-		for (c = selmon->clients; c && !visible; c = c->next)
-			if (nextseltags & c->tags) {
-				visible = 1;
-				break;
-			}
-		i += arg->i;
-	} while (!visible && ++count < 10);
+			// Check if tag is visible
+			for (c = selmon->clients; c && !visible; c = c->next)
+				if (tsintersects(nextseltags, c->tags)) {
+					visible = 1;
+					break;
+				}
+			i += d;
+		} while (!visible && ++count < 10);
+		if (count >= 10)
+			break;
+		curseltags = nextseltags;
+	}
 
-	if (count < 10) {
-		a.i = nextseltags;
+	if (!tsequal(curseltags, selmon->tagset[selmon->seltags])) {
+		a.t = curseltags;
 		view(&a);
 	}
 }
@@ -4565,48 +7889,361 @@ shiftview(const Arg *arg)
 
 void
 viewtoright(const Arg *arg) {
-	int i;
+	viewby(1);
+}
 
-	if(__builtin_popcount(selmon->tagset[selmon->seltags] & TAGMASK) == 1
-	&& selmon->tagset[selmon->seltags] & (TAGMASK >> 1)) {
-		selmon->seltags ^= 1; /* toggle sel tagset */
-		selmon->tagset[selmon->seltags] = selmon->tagset[selmon->seltags ^ 1] << 1;
-		
-		selmon->pertag->prevtag = selmon->pertag->curtag;
 
-		if (selmon->tagset[selmon->seltags ^ 1] << 1 == ~0)
-			selmon->pertag->curtag = 0;
-		else {
-			for (i = 0; !(selmon->tagset[selmon->seltags ^ 1] << 1 & 1 << i); i++) ;
-			selmon->pertag->curtag = i + 1;
+void
+moveright(const Arg *arg) {
+	tagtoright(arg);
+	viewtoright(arg);	
+}
+
+// toggle overview like layout
+#ifdef COMPOSITE
+void
+damagenotify(XEvent *e)
+{
+	XDamageNotifyEvent *ev = (XDamageNotifyEvent *)e;
+	XRectangle *r;
+	Client *c;
+	int x2, y2;
+
+	if (!(c = wintoclient(ev->drawable)))
+		return;
+	r = &c->damaged;
+	if (!r->width || !r->height) {
+		*r = ev->area;
+		return;
+	}
+	x2 = MAX(r->x + r->width, ev->area.x + ev->area.width);
+	y2 = MAX(r->y + r->height, ev->area.y + ev->area.height);
+	r->x = MIN(r->x, ev->area.x);
+	r->y = MIN(r->y, ev->area.y);
+	r->width = x2 - r->x;
+	r->height = y2 - r->y;
+}
+
+/* thumbnails stay usable while a client is redirected, the server keeps
+ * painting its contents into an offscreen pixmap. That is also the only
+ * copy of clients on hidden tags, which overview() and slideview() show,
+ * so clients stay redirected for their lifetime; what is only needed
+ * while the overview is open, damage tracking, is set up lazily, see
+ * trackdamage() */
+void
+setredirect(Client *c, int redirect)
+{
+	if (!composite || c->redirected == redirect)
+		return;
+	if (redirect)
+		XCompositeRedirectWindow(dpy, c->win, CompositeRedirectAutomatic);
+	else
+		XCompositeUnredirectWindow(dpy, c->win, CompositeRedirectAutomatic);
+	c->redirected = redirect;
+}
+
+/* Damage objects exist only while the overview is open, a client that
+ * starts being tracked has its thumbnail redone in full */
+void
+trackdamage(Client *c, int track)
+{
+	if (!composite || !c->damage == !track)
+		return;
+	if (track) {
+		c->damage = XDamageCreate(dpy, c->win, XDamageReportBoundingBox);
+		c->damaged.x = c->damaged.y = 0;
+		c->damaged.width = c->w;
+		c->damaged.height = c->h;
+	} else {
+		XDamageDestroy(dpy, c->damage);
+		c->damage = None;
+	}
+}
+
+/* bring the scaled copy of c up to date; only the damaged part is
+ * rescaled unless the size of the thumbnail changed. Returns 1 if the
+ * thumbnail was touched */
+int
+updatethumb(Client *c, int tw, int th)
+{
+	XTransform xf = {{{ 0 }}};
+	Pixmap pix;
+	Picture src;
+	double sx, sy;
+	int x, y, w, h;
+
+	if (!c->redirected
+	|| ((c->thumbw == tw && c->thumbh == th) && (!c->damaged.width || !c->damaged.height))
+	|| HIDDEN(c))
+		return 0; /* nothing new, or keep what was captured before */
+	sx = (double)tw / WIDTH(c);
+	sy = (double)th / HEIGHT(c);
+	if (c->thumbw != tw || c->thumbh != th) {
+		if (c->thumbpict) {
+			XRenderFreePicture(dpy, c->thumbpict);
+			XFreePixmap(dpy, c->thumb);
 		}
+		c->thumb = XCreatePixmap(dpy, root, tw, th, DefaultDepth(dpy, screen));
+		c->thumbpict = XRenderCreatePicture(dpy, c->thumb,
+			XRenderFindVisualFormat(dpy, DefaultVisual(dpy, screen)), 0, NULL);
+		c->thumbw = tw;
+		c->thumbh = th;
+		x = y = 0;
+		w = tw;
+		h = th;
+	} else {
+		/* damage is relative to the inside of the border */
+		x = (c->damaged.x + c->bw) * sx;
+		y = (c->damaged.y + c->bw) * sy;
+		w = MIN((c->damaged.x + c->bw + c->damaged.width) * sx + 1, tw) - x;
+		h = MIN((c->damaged.y + c->bw + c->damaged.height) * sy + 1, th) - y;
+		if (w <= 0 || h <= 0)
+			return 0;
+	}
+	c->damaged.width = c->damaged.height = 0;
+	XDamageSubtract(dpy, c->damage, None, None);
+
+	pix = XCompositeNameWindowPixmap(dpy, c->win);
+	src = XRenderCreatePicture(dpy, pix, c->format, 0, NULL);
+	xf.matrix[0][0] = XDoubleToFixed(1 / sx);
+	xf.matrix[1][1] = XDoubleToFixed(1 / sy);
+	xf.matrix[2][2] = XDoubleToFixed(1);
+	XRenderSetPictureTransform(dpy, src, &xf);
+	XRenderSetPictureFilter(dpy, src, FilterGood, NULL, 0);
+	XRenderComposite(dpy, PictOpSrc, src, None, c->thumbpict, x, y, 0, 0, x, y, w, h);
+	XRenderFreePicture(dpy, src);
+	XFreePixmap(dpy, pix);
+	return 1;
+}
 
-		selmon->nmaster = selmon->pertag->nmasters[selmon->pertag->curtag];
-		selmon->mfact = selmon->pertag->mfacts[selmon->pertag->curtag];
-		selmon->sellt = selmon->pertag->sellts[selmon->pertag->curtag];
-		selmon->lt[selmon->sellt] = selmon->pertag->ltidxs[selmon->pertag->curtag][selmon->sellt];
-		selmon->lt[selmon->sellt^1] = selmon->pertag->ltidxs[selmon->pertag->curtag][selmon->sellt^1];
+static void
+thumbgeom(Overview *o, int i, int *x, int *y, int *w, int *h)
+{
+	Client *c = o->clients[i];
+	int pad = lrpad / 2, cw = o->mon->ww / o->cols, ch = o->mon->wh / o->rows;
+	int bw = cw - 2 * pad, bht = ch - 3 * pad - bh;
+	double scale = MIN(1.0, MIN((double)bw / WIDTH(c), (double)bht / HEIGHT(c)));
 
-		if (selmon->showbar != selmon->pertag->showbars[selmon->pertag->curtag])
-			togglebar(NULL);
+	*w = MAX(1, WIDTH(c) * scale);
+	*h = MAX(1, HEIGHT(c) * scale);
+	*x = (i % o->cols) * cw + pad + (bw - *w) / 2;
+	*y = (i / o->cols) * ch + pad + (bht - *h) / 2;
+}
 
-		
-		focus(NULL);
-		arrange(selmon);
+void
+refreshthumbs(Overview *o, int draw)
+{
+	int i, x, y, w, h;
+
+	/* clients can unmap at any time, their pixmaps are gone then */
+	XSetErrorHandler(xerrordummy);
+	for (i = 0; i < o->n; i++) {
+		thumbgeom(o, i, &x, &y, &w, &h);
+		if (updatethumb(o->clients[i], w, h) && draw)
+			drawoverview(o, i);
+	}
+	XSync(dpy, False);
+	XSetErrorHandler(xerror);
+}
+
+/* draw cell i, or the whole overview if i is negative */
+void
+drawoverview(Overview *o, int i)
+{
+	Client *c;
+	int cw = o->mon->ww / o->cols, ch = o->mon->wh / o->rows;
+	int pad = lrpad / 2, x, y, w, h, end = i + 1;
+
+	if (i < 0) {
+		XRenderFillRectangle(dpy, PictOpSrc, o->pict, &scheme[SchemeNorm][ColBg].color,
+			0, 0, o->mon->ww, o->mon->wh);
+		i = 0;
+		end = o->n;
+	}
+	for (; i < end; i++) {
+		c = o->clients[i];
+		XRenderFillRectangle(dpy, PictOpSrc, o->pict,
+			&scheme[i == o->sel ? SchemeSel : SchemeNorm][ColBg].color,
+			(i % o->cols) * cw, (i / o->cols) * ch, cw, ch);
+		thumbgeom(o, i, &x, &y, &w, &h);
+		if (c->thumbpict && c->thumbw == w && c->thumbh == h)
+			XRenderComposite(dpy, PictOpSrc, c->thumbpict, None, o->pict,
+				0, 0, 0, 0, x, y, w, h);
+		else
+			XRenderFillRectangle(dpy, PictOpSrc, o->pict,
+				&scheme[SchemeHid][ColFg].color, x, y, w, h);
+		XFTLOCK();
+		drw_setscheme(drw, scheme[i == o->sel ? SchemeSel : SchemeNorm]);
+		drw_text(drw, 0, 0, cw - 2 * pad, bh, lrpad / 2, c->name, 0, 0);
+		drw_copy(drw, o->win, 0, 0, cw - 2 * pad, bh,
+			(i % o->cols) * cw + pad, (i / o->cols + 1) * ch - pad - bh);
+		XFTUNLOCK();
 	}
 }
 
+int
+overviewcell(Overview *o, int x, int y)
+{
+	int i;
+
+	x -= o->mon->wx;
+	y -= o->mon->wy;
+	if (x < 0 || y < 0 || x >= o->mon->ww || y >= o->mon->wh)
+		return -1;
+	i = y / (o->mon->wh / o->rows) * o->cols + x / (o->mon->ww / o->cols);
+	return i < o->n ? i : -1;
+}
 
+/* exposé style overview of the clients on the selected monitor whose tags
+ * match arg->t. Clients are neither moved nor resized, their contents
+ * are shown as thumbnails which are only updated where damaged */
 void
-moveright(const Arg *arg) {
-	tagtoright(arg);
-	viewtoright(arg);	
+overview(const Arg *arg)
+{
+	Overview o = { .mon = selmon };
+	Monitor *m;
+	Client *c, *chosen = NULL;
+	XEvent ev;
+	KeySym ksym;
+	int i, initial, relist = 1, redraw = 0;
+	XSetWindowAttributes wa = {
+		.override_redirect = True,
+		.background_pixel = scheme[SchemeNorm][ColBg].pixel,
+		.event_mask = ExposureMask
+	};
+
+	o.win = XCreateWindow(dpy, root, o.mon->wx, o.mon->wy, o.mon->ww, o.mon->wh, 0,
+			DefaultDepth(dpy, screen), CopyFromParent, DefaultVisual(dpy, screen),
+			CWOverrideRedirect|CWBackPixel|CWEventMask, &wa);
+	o.pict = XRenderCreatePicture(dpy, o.win,
+		XRenderFindVisualFormat(dpy, DefaultVisual(dpy, screen)), 0, NULL);
+	if (XGrabKeyboard(dpy, root, True, GrabModeAsync, GrabModeAsync, CurrentTime) != GrabSuccess
+	|| XGrabPointer(dpy, root, False, ButtonPressMask|PointerMotionMask, GrabModeAsync,
+		GrabModeAsync, None, cursor[CurNormal]->cursor, CurrentTime) != GrabSuccess) {
+		XUngrabKeyboard(dpy, CurrentTime);
+		goto out;
+	}
+	XMapRaised(dpy, o.win);
+
+	for (;;) {
+		if (relist) {
+			initial = !o.clients;
+			free(o.clients);
+			for (o.n = 0, c = o.mon->clients; c; c = c->next)
+				o.n += tsintersects(c->tags, arg->t);
+			if (!o.n)
+				goto done;
+			o.clients = ecalloc(o.n, sizeof(Client *));
+			for (i = 0, c = o.mon->clients; c; c = c->next)
+				if (tsintersects(c->tags, arg->t)) {
+					if (c == o.mon->sel && initial)
+						o.sel = i;
+					trackdamage(c, 1);
+					o.clients[i++] = c;
+				}
+			for (o.cols = 1; o.cols * o.cols < o.n; o.cols++);
+			o.rows = (o.n + o.cols - 1) / o.cols;
+			o.sel = MIN(o.sel, o.n - 1);
+			relist = 0;
+			redraw = 1;
+		}
+		if (!XPending(dpy)) {
+			refreshthumbs(&o, !redraw);
+			if (redraw)
+				drawoverview(&o, -1);
+			redraw = 0;
+		}
+		XNextEvent(dpy, &ev);
+		switch(ev.type) {
+		case KeyPress:
+			ksym = XLookupKeysym(&ev.xkey, 0);
+			switch (ksym) {
+			case XK_Escape:
+				goto done;
+			case XK_Return:
+			case XK_KP_Enter:
+			case XK_space:
+				chosen = o.clients[o.sel];
+				goto done;
+			case XK_Left:
+			case XK_h:
+				o.sel = (o.sel + o.n - 1) % o.n;
+				break;
+			case XK_Right:
+			case XK_l:
+				o.sel = (o.sel + 1) % o.n;
+				break;
+			case XK_Up:
+			case XK_k:
+				if (o.sel >= o.cols)
+					o.sel -= o.cols;
+				break;
+			case XK_Down:
+			case XK_j:
+				if (o.sel + o.cols < o.n)
+					o.sel += o.cols;
+				break;
+			case XK_Tab:
+				o.sel = (ev.xkey.state & ShiftMask ? o.sel + o.n - 1 : o.sel + 1) % o.n;
+				break;
+			}
+			redraw = 1;
+			break;
+		case ButtonPress:
+			if ((i = overviewcell(&o, ev.xbutton.x_root, ev.xbutton.y_root)) >= 0)
+				chosen = o.clients[i];
+			goto done;
+		case MotionNotify:
+			while (XCheckTypedEvent(dpy, MotionNotify, &ev));
+			if ((i = overviewcell(&o, ev.xmotion.x_root, ev.xmotion.y_root)) >= 0 && i != o.sel) {
+				o.sel = i;
+				redraw = 1;
+			}
+			break;
+		case KeyRelease:
+			break;
+		case Expose:
+			if (ev.xexpose.window == o.win)
+				redraw |= !ev.xexpose.count;
+			else
+				dispatch(&ev);
+			break;
+		case MapRequest:
+		case UnmapNotify:
+		case DestroyNotify:
+			dispatch(&ev);
+			XRaiseWindow(dpy, o.win);
+			relist = 1;
+			break;
+		default:
+			dispatch(&ev);
+			break;
+		}
+	}
+done:
+	XUngrabPointer(dpy, CurrentTime);
+	XUngrabKeyboard(dpy, CurrentTime);
+out:
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			trackdamage(c, 0);
+	XRenderFreePicture(dpy, o.pict);
+	XDestroyWindow(dpy, o.win);
+	free(o.clients);
+	if (chosen)
+		switchtoclient(chosen);
 }
+#endif /* COMPOSITE */
 
-// toggle overview like layout
 void
 overtoggle(const Arg *arg){
 
+#ifdef COMPOSITE
+	if (composite && selmon->pertag->curtag) {
+		overview(arg);
+		return;
+	}
+#endif /* COMPOSITE */
 	if (!selmon->pertag->curtag == 0) {
 		selmon->lt[selmon->sellt] = selmon->pertag->ltidxs[0][selmon->sellt] = (Layout *)&layouts[6];
 		view(arg);
@@ -4748,7 +8385,7 @@ winview(const Arg* arg){
 
 	if (!(c = wintoclient(win))) return;
 
-	a.ui = c->tags;
+	a.t = c->tags;
 	view(&a);
 }
 
@@ -4758,6 +8395,11 @@ winview(const Arg* arg){
 int
 xerror(Display *dpy, XErrorEvent *ee)
 {
+#ifdef BARTHREAD
+	/* the renderer may draw a snapshot of a bar that is gone by now */
+	if (bdpy && dpy == bdpy)
+		return 0;
+#endif /* BARTHREAD */
 	if (ee->error_code == BadWindow
 	|| (ee->request_code == X_SetInputFocus && ee->error_code == BadMatch)
 	|| (ee->request_code == X_PolyText8 && ee->error_code == BadDrawable)
@@ -4768,6 +8410,13 @@ xerror(Display *dpy, XErrorEvent *ee)
 	|| (ee->request_code == X_GrabKey && ee->error_code == BadAccess)
 	|| (ee->request_code == X_CopyArea && ee->error_code == BadDrawable))
 		return 0;
+#ifdef COMPOSITE
+	/* windows can vanish before their redirection and damage requests
+	 * are processed */
+	if (composite && (ee->request_code == compositeop || ee->request_code == damageop
+	|| ee->error_code == damageerror + BadDamage))
+		return 0;
+#endif /* COMPOSITE */
 	fprintf(stderr, "instantwm: fatal error: request code=%d, error code=%d\n",
 		ee->request_code, ee->error_code);
 	return xerrorxlib(dpy, ee); /* may call exit */
@@ -4821,23 +8470,39 @@ zoom(const Arg *arg)
 int
 main(int argc, char *argv[])
 {
+	int restored = 0;
+
 	if (argc == 2 && !strcmp("-v", argv[1]))
 		die("instantwm-"VERSION);
+	else if (argc == 3 && !strcmp("-r", argv[1]))
+		restored = 1;
 	else if (argc != 1)
-		die("usage: instantwm [-v]");
+		die("usage: instantwm [-v] [-r statefile]");
+	wmpath = argv[0];
+#ifdef BARTHREAD
+	if (!XInitThreads())
+		die("instantwm: no Xlib thread support");
+#endif /* BARTHREAD */
 	if (!setlocale(LC_CTYPE, "") || !XSupportsLocale())
 		fputs("warning: no locale support\n", stderr);
 	if (!(dpy = XOpenDisplay(NULL)))
 		die("instantwm: cannot open display");
+	/* keep the X connection out of spawned children */
+	fcntl(ConnectionNumber(dpy), F_SETFD, FD_CLOEXEC);
 	checkotherwm();
+	if (restored)
+		readstate(argv[2]);
 	setup();
 #ifdef __OpenBSD__
-	if (pledge("stdio rpath proc exec", NULL) == -1)
+	if (pledge("stdio rpath wpath cpath proc exec", NULL) == -1)
 		die("pledge");
 #endif /* __OpenBSD__ */
 	scan();
-	runAutostart();
+	if (!restored)
+		runAutostart();
 	run();
+	if (restarting)
+		execrestart();
 	cleanup();
 	XCloseDisplay(dpy);
 	return EXIT_SUCCESS;